@@ -0,0 +1,202 @@
+#include "aggregate.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "csv.h"
+
+using namespace std;
+
+// Team of the row holding the statistics of a whole competition, and competition and
+// team of the row holding the size of the store. Field values come from SVG ids or
+// digits, which can't contain it.
+const char* const ALL_TEAMS = "*";
+
+// Save after this many changed records, or this long after the first unsaved one.
+const size_t SAVE_RECORDS = 32;
+const chrono::seconds SAVE_INTERVAL(2);
+
+double RunningStat::variance(long count) const {
+	if (count < 2) {
+		return 0;
+	}
+	double variance = (SumSquares - Sum * Sum / count) / (count - 1);
+	return variance > 0 ? variance : 0;
+}
+
+static string formatNumber(double value, int precision) {
+	char text[32];
+	snprintf(text, sizeof(text), "%.*g", precision, value);
+	return text;
+}
+
+vector<string> Aggregates::header() const {
+	vector<string> columns { "competition", "team", "matches" };
+	for (auto&& name : names) {
+		columns.insert(columns.end(),
+				{ name + "_mean", name + "_variance", name + "_sum", name + "_sumsquares" });
+	}
+	return columns;
+}
+
+Aggregates::~Aggregates() {
+	if (pending > 0) {
+		save();
+	}
+}
+
+bool Aggregates::open(const string path, const string schemaFile,
+		const vector<string>& fieldNames, const MatchStore& store) {
+	this->path = path;
+	this->store = &store;
+
+	auto fieldIndex = [&](const string& name, size_t& outIndex) {
+		for (size_t i = 0; i < fieldNames.size(); i++) {
+			if (fieldNames[i] == name) {
+				outIndex = i;
+				return true;
+			}
+		}
+		cerr << "Error: " << schemaFile << " has no field named " << name << endl;
+		return false;
+	};
+
+	if (!fieldIndex("competition", competitionField) || !fieldIndex("team", teamField)) {
+		return false;
+	}
+
+	ifstream file(schemaFile);
+	string line;
+	while (getline(file, line)) {
+		istringstream tokens(line);
+		string keyword, name;
+		if (!(tokens >> keyword) || keyword != "stats") {
+			continue;
+		}
+		while (tokens >> name) {
+			size_t index;
+			if (!fieldIndex(name, index)) {
+				return false;
+			}
+			fields.push_back(index);
+			names.push_back(name);
+		}
+	}
+
+	// Load the saved sums. Files saved with other stats fields are rebuilt from scratch.
+	ifstream in(path, ios::binary);
+	skipBOM(in);
+	vector<string> row;
+	if (!in || !parseCsvLine(in, row)) {
+		return rebuild();
+	}
+
+	auto columns = header();
+	if (row != columns) {
+		cerr << path << " has different stats, rebuilding it." << endl;
+		return rebuild();
+	}
+
+	bool sized = false;
+	while (parseCsvLine(in, row)) {
+		if (row.size() != columns.size()) {
+			continue;
+		}
+		if (row[0] == ALL_TEAMS && row[1] == ALL_TEAMS) {
+			storeRows = strtoul(row[2].c_str(), nullptr, 10);
+			sized = true;
+			continue;
+		}
+		auto& group = groups[{ row[0], row[1] }];
+		group.Count = atol(row[2].c_str());
+		group.Stats.resize(fields.size());
+		for (size_t i = 0; i < fields.size(); i++) {
+			group.Stats[i].Sum = atof(row[3 + i * 4 + 2].c_str());
+			group.Stats[i].SumSquares = atof(row[3 + i * 4 + 3].c_str());
+		}
+	}
+
+	// Records stored without updating the statistics, e.g. by a crash before they were
+	// saved, change the size of the store.
+	if (!sized || storeRows != store.logSize()) {
+		cerr << path << " is out of date with the match store, rebuilding it." << endl;
+		return rebuild();
+	}
+	return true;
+}
+
+bool Aggregates::rebuild() {
+	groups.clear();
+	for (auto&& row : store->records()) {
+		update(row, 1);
+	}
+	return save();
+}
+
+void Aggregates::add(const vector<string>& row) {
+	update(row, 1);
+}
+
+void Aggregates::remove(const vector<string>& row) {
+	update(row, -1);
+}
+
+void Aggregates::update(const vector<string>& row, double sign) {
+	pending++;
+	const string& competition = row[competitionField];
+	for (auto&& key : { make_pair(competition, row[teamField]), make_pair(competition, string(ALL_TEAMS)) }) {
+		auto& group = groups[key];
+		group.Count += static_cast<long>(sign);
+		group.Stats.resize(fields.size());
+		for (size_t i = 0; i < fields.size(); i++) {
+			double value = atof(row[fields[i]].c_str());
+			group.Stats[i].Sum += sign * value;
+			group.Stats[i].SumSquares += sign * value * value;
+		}
+
+		if (group.Count <= 0) {
+			groups.erase(key);
+		}
+	}
+}
+
+bool Aggregates::saveIfDue() {
+	if (pending >= SAVE_RECORDS
+			|| (pending > 0 && chrono::steady_clock::now() - lastSave >= SAVE_INTERVAL)) {
+		return save();
+	}
+	return true;
+}
+
+bool Aggregates::save() {
+	auto row = header();
+	string contents = "\xef\xbb\xbf" + formatCsvLine(row);
+
+	for (auto&& group : groups) {
+		row.assign({ group.first.first, group.first.second, to_string(group.second.Count) });
+		for (auto&& stat : group.second.Stats) {
+			row.push_back(formatNumber(stat.mean(group.second.Count), 6));
+			row.push_back(formatNumber(stat.variance(group.second.Count), 6));
+			// Keep the sums exact so they can be loaded and updated later.
+			row.push_back(formatNumber(stat.Sum, 17));
+			row.push_back(formatNumber(stat.SumSquares, 17));
+		}
+		contents += formatCsvLine(row);
+	}
+
+	storeRows = store->logSize();
+	row.assign(header().size(), "");
+	row[0] = row[1] = ALL_TEAMS;
+	row[2] = to_string(storeRows);
+	contents += formatCsvLine(row);
+
+	// Pending changes stay pending if the file can't be written.
+	lastSave = chrono::steady_clock::now();
+	if (!replaceFile(path, contents)) {
+		return false;
+	}
+	pending = 0;
+	return true;
+}
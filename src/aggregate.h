@@ -0,0 +1,76 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "matchstore.h"
+
+// Sums from which the mean and variance of a field are derived. Unlike a running
+// mean, sums let an overwritten record be taken back out exactly.
+struct RunningStat {
+	double Sum = 0;
+	double SumSquares = 0;
+
+	double mean(long count) const { return count > 0 ? Sum / count : 0; }
+	double variance(long count) const;
+};
+
+struct TeamStats {
+	long Count = 0;
+	std::vector<RunningStat> Stats;
+};
+
+// Per-team and per-competition statistics of the fields named on the "stats" lines
+// of a field schema, e.g.
+//   stats lander depot hanging
+// They are updated as records are committed and saved as a small CSV file with one row
+// per competition and team, plus a row with team "*" per competition, so the scouting
+// dashboard doesn't need to recompute them from every match. A last row with
+// competition and team "*" holds the number of rows in the match store's log when the
+// file was saved; if the store has changed since, the statistics are rebuilt from it.
+class Aggregates {
+public:
+	Aggregates() = default;
+	~Aggregates();
+
+	Aggregates(const Aggregates&) = delete;
+	Aggregates& operator=(const Aggregates&) = delete;
+
+	// Load the stats fields from the schema file and the current statistics from path.
+	// fieldNames are the names of the fields of each record. The store holds the records
+	// with the same fields and must outlive the aggregates; only records it takes are
+	// added, so rescans and resumed batches aren't counted twice.
+	bool open(const std::string path, const std::string schemaFile,
+			const std::vector<std::string>& fieldNames, const MatchStore& store);
+
+	// Add or take back a record, given in field order.
+	void add(const std::vector<std::string>& row);
+	void remove(const std::vector<std::string>& row);
+
+	// Save once enough records have changed or enough time has passed since the last
+	// save. Records still pending are saved when the aggregates are destroyed.
+	bool saveIfDue();
+	bool save();
+
+private:
+	std::vector<std::string> header() const;
+	void update(const std::vector<std::string>& row, double sign);
+	bool rebuild();
+
+	std::string path;
+	const MatchStore* store = nullptr;
+	size_t storeRows = 0;
+	size_t competitionField = 0;
+	size_t teamField = 0;
+	std::vector<size_t> fields;
+	std::vector<std::string> names;
+	std::map<std::pair<std::string, std::string>, TeamStats> groups;
+	size_t pending = 0;
+	std::chrono::steady_clock::time_point lastSave = std::chrono::steady_clock::now();
+};
+
+#endif
@@ -0,0 +1,37 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+// Keep every Mat aligned for SIMD loads.
+const size_t ALIGNMENT = 64;
+
+void ScratchArena::reset() {
+	highWater = max(highWater, requested);
+	if (highWater + ALIGNMENT > buffer.size()) {
+		buffer.assign(highWater + ALIGNMENT, 0);
+	}
+	used = 0;
+	requested = 0;
+}
+
+cv::Mat ScratchArena::mat(cv::Size size, int type) {
+	return mat(size.height, size.width, type);
+}
+
+cv::Mat ScratchArena::mat(int rows, int cols, int type) {
+	size_t step = (static_cast<size_t>(cols) * CV_ELEM_SIZE(type) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	size_t bytes = step * rows;
+	requested += bytes;
+
+	auto base = reinterpret_cast<uintptr_t>(buffer.data());
+	size_t offset = (base + used + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT - base;
+	if (buffer.empty() || offset + bytes > buffer.size()) {
+		return cv::Mat(rows, cols, type);
+	}
+
+	used = offset + bytes;
+	return cv::Mat(rows, cols, type, buffer.data() + offset, step);
+}
@@ -0,0 +1,32 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+// Hands out cv::Mat temporaries from one reusable buffer. Mats taken from the arena
+// are valid until the next reset(). A request that doesn't fit falls back to the heap
+// and the buffer grows to the high-water mark on the next reset(), so after the first
+// few sheets no temporaries are allocated at all.
+class ScratchArena {
+public:
+	// Release every Mat taken since the last reset.
+	void reset();
+
+	// An uninitialized Mat backed by the arena.
+	cv::Mat mat(cv::Size size, int type);
+	cv::Mat mat(int rows, int cols, int type);
+
+	// Bytes needed by the largest set of temporaries seen so far.
+	size_t capacity() const { return buffer.size(); }
+
+private:
+	std::vector<unsigned char> buffer;
+	size_t used = 0;
+	size_t requested = 0;
+	size_t highWater = 0;
+};
+
+#endif
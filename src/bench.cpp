@@ -0,0 +1,546 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "csv.h"
+#include "decode.h"
+#include "ingest.h"
+#include "scanner.h"
+#include "timing.h"
+
+using namespace std;
+
+// Heap allocations since the program started. Mat data is always counted; other heap
+// allocations only in builds with SCORESCAN_COUNT_ALLOCATIONS defined, which replaces
+// the global operator new for the whole program.
+static atomic<long> allocations { 0 };
+
+#ifdef SCORESCAN_COUNT_ALLOCATIONS
+void* operator new(size_t size) {
+	allocations.fetch_add(1, memory_order_relaxed);
+	if (void* memory = malloc(size == 0 ? 1 : size)) {
+		return memory;
+	}
+	throw bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+	free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+	free(memory);
+}
+#endif
+
+// OpenCV allocates Mat data itself, so count those through the default allocator.
+class CountingMatAllocator : public cv::MatAllocator {
+public:
+	cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+			int flags, cv::UMatUsageFlags usageFlags) const override {
+		allocations.fetch_add(1, memory_order_relaxed);
+		return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+	}
+
+	bool allocate(cv::UMatData* data, int accessFlags, cv::UMatUsageFlags usageFlags) const override {
+		return cv::Mat::getStdAllocator()->allocate(data, accessFlags, usageFlags);
+	}
+
+	void deallocate(cv::UMatData* data) const override {
+		cv::Mat::getStdAllocator()->deallocate(data);
+	}
+};
+
+// Competitions printed in generated QR codes.
+const char* const COMPETITIONS[] = { "Brattain119", "Brattain219", "HoustonJemison19", "HoustonFranklin19" };
+
+// Flatten the cubic bezier paths of a shape into polygons.
+static vector<vector<cv::Point>> flattenShape(const NSVGshape* shape) {
+	const int STEPS = 8;
+	vector<vector<cv::Point>> polygons;
+
+	for (auto path = shape->paths; path != nullptr; path = path->next) {
+		vector<cv::Point> polygon { cv::Point(cvRound(path->pts[0]), cvRound(path->pts[1])) };
+		for (int i = 0; i + 3 < path->npts; i += 3) {
+			const float* p = &path->pts[i * 2];
+			for (int step = 1; step <= STEPS; step++) {
+				float t = static_cast<float>(step) / STEPS, u = 1 - t;
+				float a = u * u * u, b = 3 * u * u * t, c = 3 * u * t * t, d = t * t * t;
+				polygon.push_back(cv::Point(
+						cvRound(a * p[0] + b * p[2] + c * p[4] + d * p[6]),
+						cvRound(a * p[1] + b * p[3] + c * p[5] + d * p[7])));
+			}
+		}
+		polygons.push_back(polygon);
+	}
+	return polygons;
+}
+
+// nanosvg colors are 0xAABBGGRR.
+static double grayOf(unsigned int color) {
+	return 0.299 * (color & 0xff) + 0.587 * ((color >> 8) & 0xff) + 0.114 * ((color >> 16) & 0xff);
+}
+
+bool SheetRenderer::load(const string svgFile, bool layoutShapes) {
+	SvgFile = svgFile;
+	Shapes = findSVGShapes(svgFile, PageSize);
+	if (Shapes.count("qr") == 0) {
+		cerr << "Error: Could not find #qr in " << svgFile << endl;
+		return false;
+	}
+	QRBox = Shapes["qr"].BoundingBox;
+	if (!layoutShapes) {
+		omitLayoutShapes(Shapes);
+	}
+	Groups = compileBubbleGroups(Shapes);
+
+	// Rasterize the visible shapes. Text is not rendered, it doesn't affect scanning.
+	NSVGimage* image = nsvgParseFromFile(svgFile.c_str(), "px", 150.0f);
+	if (image == nullptr) {
+		return false;
+	}
+
+	Page = cv::Mat(PageSize, CV_8UC1, cv::Scalar(255));
+	for (auto shape = image->shapes; shape != nullptr; shape = shape->next) {
+		if (!(shape->flags & NSVG_FLAGS_VISIBLE)) {
+			continue;
+		}
+		auto polygons = flattenShape(shape);
+		if (shape->fill.type == NSVG_PAINT_COLOR) {
+			cv::fillPoly(Page, polygons, cv::Scalar(grayOf(shape->fill.color)), cv::LINE_AA);
+		}
+		if (shape->stroke.type == NSVG_PAINT_COLOR && shape->strokeWidth > 0) {
+			cv::polylines(Page, polygons, true, cv::Scalar(grayOf(shape->stroke.color)),
+					max(1, cvRound(shape->strokeWidth)), cv::LINE_AA);
+		}
+	}
+
+	nsvgDelete(image);
+	return true;
+}
+
+SyntheticSheet generateSheet(const SheetRenderer& renderer, unsigned seed) {
+	cv::RNG rng(seed);
+	SyntheticSheet sheet;
+	sheet.Marked.assign(shapeIds(renderer.Shapes).size(), false);
+	cv::Mat page = renderer.Page.clone();
+
+	// Mark at most one option per group, like a careful scout would.
+	for (auto&& group : renderer.Groups) {
+		int marked = rng.uniform(0.0, 1.0) < 0.75 ? rng.uniform(0, static_cast<int>(group.ShapeIds.size())) : -1;
+		for (size_t i = 0; i < group.ShapeIds.size(); i++) {
+			sheet.Marked[group.Ordinals[i]] = static_cast<int>(i) == marked;
+		}
+		if (marked >= 0) {
+			// Pencil marks vary in darkness.
+			vector<vector<cv::Point>> outline { renderer.Shapes.at(group.ShapeIds[marked]).Outline };
+			cv::fillPoly(page, outline, cv::Scalar(rng.uniform(20, 90)), cv::LINE_AA);
+		}
+	}
+
+	// Print the QR code over the placeholder, filling its box exactly.
+	sheet.QRData = COMPETITIONS[rng.uniform(0, static_cast<int>(sizeof(COMPETITIONS) / sizeof(COMPETITIONS[0])))];
+	auto qr = encodeQRCode(sheet.QRData);
+	float module = renderer.QRBox.width / qr.Size;
+	for (int y = 0; y < qr.Size; y++) {
+		for (int x = 0; x < qr.Size; x++) {
+			if (qr.dark(x, y)) {
+				cv::Point2f topLeft(renderer.QRBox.x + x * module, renderer.QRBox.y + y * module);
+				cv::rectangle(page, cv::Rect(cvRound(topLeft.x), cvRound(topLeft.y),
+						cvRound(topLeft.x + module) - cvRound(topLeft.x),
+						cvRound(topLeft.y + module) - cvRound(topLeft.y)), cv::Scalar(0), cv::FILLED);
+			}
+		}
+	}
+
+	// Place the page on a darker background with some rotation and perspective, turned
+	// a quarter turn more for each seed.
+	sheet.QuarterTurns = static_cast<int>(seed % 4);
+	cv::Size canvasSize(renderer.PageSize.width * 3 / 2, renderer.PageSize.height * 3 / 2);
+	if (sheet.QuarterTurns % 2 == 1) {
+		swap(canvasSize.width, canvasSize.height);
+	}
+	cv::Point2f center(canvasSize.width / 2.0f, canvasSize.height / 2.0f);
+	double angle = (rng.uniform(-8.0, 8.0) + 90 * sheet.QuarterTurns) * CV_PI / 180;
+	double scale = rng.uniform(0.9, 1.2);
+	float jitter = renderer.PageSize.width * 0.03f;
+
+	vector<cv::Point2f> pageCorners = rectCorners(cv::Rect2f(0, 0,
+			static_cast<float>(renderer.PageSize.width), static_cast<float>(renderer.PageSize.height)));
+	vector<cv::Point2f> placed;
+	for (auto&& corner : pageCorners) {
+		float x = (corner.x - renderer.PageSize.width / 2.0f) * static_cast<float>(scale);
+		float y = (corner.y - renderer.PageSize.height / 2.0f) * static_cast<float>(scale);
+		placed.push_back(cv::Point2f(
+				center.x + static_cast<float>(x * cos(angle) - y * sin(angle)) + static_cast<float>(rng.uniform(-jitter, jitter)),
+				center.y + static_cast<float>(x * sin(angle) + y * cos(angle)) + static_cast<float>(rng.uniform(-jitter, jitter))));
+	}
+
+	double background = rng.uniform(40.0, 110.0);
+	cv::warpPerspective(page, sheet.Image, cv::getPerspectiveTransform(pageCorners, placed), canvasSize,
+			cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(background));
+
+	// Uneven lighting, a linear falloff in a random direction.
+	double direction = rng.uniform(0.0, 2 * CV_PI);
+	double falloff = rng.uniform(0.0, 0.35);
+	double dx = cos(direction) / canvasSize.width, dy = sin(direction) / canvasSize.height;
+	for (int y = 0; y < canvasSize.height; y++) {
+		uchar* row = sheet.Image.ptr<uchar>(y);
+		for (int x = 0; x < canvasSize.width; x++) {
+			double light = 1.0 - falloff * (0.5 + (x - center.x) * dx + (y - center.y) * dy);
+			row[x] = cv::saturate_cast<uchar>(row[x] * light);
+		}
+	}
+
+	double sigma = rng.uniform(0.3, 1.5);
+	cv::GaussianBlur(sheet.Image, sheet.Image, { }, sigma, sigma);
+
+	// Sensor noise.
+	double noise = rng.uniform(2.0, 8.0);
+	for (int y = 0; y < canvasSize.height; y++) {
+		uchar* row = sheet.Image.ptr<uchar>(y);
+		for (int x = 0; x < canvasSize.width; x++) {
+			row[x] = cv::saturate_cast<uchar>(row[x] + rng.gaussian(noise));
+		}
+	}
+
+	return sheet;
+}
+
+// Difference between sampled and full page threshold levels, and the work done by the
+// tiered sampler.
+struct ScanStats {
+	long Sheets = 0;
+	long Total = 0;
+	int Max = 0;
+
+	// Bubbles the tiered sampler escalated to full sampling.
+	long Bubbles = 0;
+	long Escalated = 0;
+
+	void add(const ScanResult& result) {
+		int error = abs(result.threshold - result.fullThreshold);
+		Sheets++;
+		Total += error;
+		Max = max(Max, error);
+		Bubbles += static_cast<long>(result.fills.size());
+		Escalated += result.escalated;
+	}
+
+	bool withinTolerance() const {
+		return Max <= THRESHOLD_TOLERANCE;
+	}
+
+	void printThreshold() const {
+		printf("threshold    max %d, mean %.2f levels from full Otsu (tolerance %d)\n",
+				Max, Sheets > 0 ? static_cast<double>(Total) / Sheets : 0.0, THRESHOLD_TOLERANCE);
+	}
+
+	void printEscalated() const {
+		printf("escalated    %.1f%% of bubbles, %.1f per sheet\n",
+				Bubbles > 0 ? 100.0 * Escalated / Bubbles : 0.0,
+				Sheets > 0 ? static_cast<double>(Escalated) / Sheets : 0.0);
+	}
+};
+
+int runBenchmark(const vector<string>& svgFiles, int sheets, unsigned seed,
+		const ScanSettings& settings) {
+	vector<SheetRenderer> renderers(svgFiles.size());
+	for (size_t i = 0; i < svgFiles.size(); i++) {
+		if (!renderers[i].load(svgFiles[i], settings.layoutShapes)) {
+			return -1;
+		}
+	}
+
+	timingsEnabled = true;
+	ScanContext context;
+	context.settings = settings;
+	context.checkThreshold = true;
+	ScanStats scanStats;
+
+	CountingMatAllocator matAllocator;
+	cv::Mat::setDefaultAllocator(&matAllocator);
+
+	// The context sizes its buffers over the first sheet of each template.
+	int warmUp = min(sheets, static_cast<int>(renderers.size()) * 2);
+	long steadyAllocations = 0;
+
+	// Tiered sampling is compared with full sampling of the same sheets, untimed.
+	ScanContext reference;
+	reference.settings = settings;
+	reference.settings.tieredSampling = false;
+
+	int found = 0;
+	int turned[4] = { }, foundTurned[4] = { };
+	long bubbles = 0, correct = 0, referenceCorrect = 0;
+	chrono::steady_clock::duration scanning { };
+
+	for (int i = 0; i < sheets; i++) {
+		auto& renderer = renderers[i % renderers.size()];
+		auto sheet = generateSheet(renderer, seed + i);
+
+		long allocationsBefore = allocations.load(memory_order_relaxed);
+		auto start = chrono::steady_clock::now();
+		auto& results = scanImage(context, sheet.Image, renderer.PageSize, renderer.QRBox, renderer.Shapes);
+		scanning += chrono::steady_clock::now() - start;
+		if (i >= warmUp) {
+			steadyAllocations += allocations.load(memory_order_relaxed) - allocationsBefore;
+		}
+
+		turned[sheet.QuarterTurns]++;
+		if (results.size() != 1 || results[0].qrData != sheet.QRData) {
+			cerr << "Sheet " << i << " (seed " << seed + i << ", turned " << 90 * sheet.QuarterTurns
+					<< " degrees) was not found" << endl;
+			continue;
+		}
+
+		found++;
+		foundTurned[sheet.QuarterTurns]++;
+		scanStats.add(results[0]);
+		for (auto&& group : renderer.Groups) {
+			for (auto ordinal : group.Ordinals) {
+				bool filled = results[0].fills[ordinal] > FILL_THRESHOLD;
+				bubbles++;
+				correct += filled == sheet.Marked[ordinal] ? 1 : 0;
+			}
+		}
+
+		if (settings.tieredSampling) {
+			timingsEnabled = false;
+			auto& sampled = scanImage(reference, sheet.Image, renderer.PageSize, renderer.QRBox,
+					renderer.Shapes);
+			timingsEnabled = true;
+			for (auto&& group : renderer.Groups) {
+				for (auto ordinal : group.Ordinals) {
+					bool filled = sampled.size() == 1 && sampled[0].fills[ordinal] > FILL_THRESHOLD;
+					referenceCorrect += filled == sheet.Marked[ordinal] ? 1 : 0;
+				}
+			}
+		}
+	}
+
+	double seconds = chrono::duration<double>(scanning).count();
+	printf("sheets       %d\n", sheets);
+	printf("found        %d (%.1f%%)\n", found, sheets > 0 ? 100.0 * found / sheets : 0.0);
+	printf("turned       0: %d/%d, 90: %d/%d, 180: %d/%d, 270: %d/%d found\n",
+			foundTurned[0], turned[0], foundTurned[1], turned[1], foundTurned[2], turned[2],
+			foundTurned[3], turned[3]);
+	printf("sheets/sec   %.2f\n", seconds > 0 ? sheets / seconds : 0.0);
+	printf("bubbles      %ld\n", bubbles);
+	printf("accuracy     %.4f%%\n", bubbles > 0 ? 100.0 * correct / bubbles : 0.0);
+#ifdef SCORESCAN_COUNT_ALLOCATIONS
+	const char* counted = "heap";
+#else
+	const char* counted = "Mat";
+#endif
+	printf("allocations  %.1f %s allocations per sheet after %d warm-up sheets\n",
+			sheets > warmUp ? static_cast<double>(steadyAllocations) / (sheets - warmUp) : 0.0, counted,
+			warmUp);
+	printf("arena        %zu KiB\n", context.arenaCapacity() / 1024);
+	scanStats.printThreshold();
+	if (settings.tieredSampling) {
+		scanStats.printEscalated();
+		printf("tiered       %+.4f%% accuracy from sampling every bubble in full\n",
+				bubbles > 0 ? 100.0 * (correct - referenceCorrect) / bubbles : 0.0);
+	}
+	printf("\n");
+	fflush(stdout);
+	printTimings(cout);
+
+	cv::Mat::setDefaultAllocator(nullptr);
+	return found == sheets && correct == bubbles && scanStats.withinTolerance() ? 0 : 1;
+}
+
+vector<string> listImages(const string& directory) {
+	const char* const EXTENSIONS[] = { ".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff" };
+	vector<cv::String> paths;
+	cv::glob(directory + "/*", paths, false);
+
+	vector<string> images;
+	for (auto&& path : paths) {
+		string name(path.substr(directory.size() + 1));
+		string extension(name.substr(min(name.size(), name.rfind('.'))));
+		transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+		for (auto&& known : EXTENSIONS) {
+			if (extension == known) {
+				images.push_back(name);
+				break;
+			}
+		}
+	}
+	sort(images.begin(), images.end());
+	return images;
+}
+
+vector<string> formColumns(const map<string, SVGShape>& shapes) {
+	vector<string> columns { "image", "form", "qr_data" };
+	for (auto&& id : shapeIds(shapes)) {
+		columns.push_back(id);
+	}
+	return columns;
+}
+
+void formatFormRow(const string& image, size_t form, const ScanResult& result,
+		vector<string>& outRow) {
+	outRow.resize(3 + result.fills.size());
+	outRow[0] = image;
+	outRow[1] = to_string(form);
+	outRow[2] = result.qrData;
+	size_t column = 3;
+	for (auto value : result.fills) {
+		char fill[32];
+		snprintf(fill, sizeof(fill), "%.6f", value);
+		outRow[column++] = fill;
+	}
+}
+
+// Key of a form in the golden file.
+static string formKey(const string& image, size_t form) {
+	return image + '\x1f' + to_string(form);
+}
+
+int runGoldenBenchmark(const string& svgFile, const string& imageDirectory,
+		const string& goldenFile, bool record, const ScanSettings& settings) {
+	cv::Size pageSize;
+	auto shapes = findSVGShapes(svgFile, pageSize);
+	if (shapes.count("qr") == 0) {
+		cerr << "Error: Could not find #qr in " << svgFile << endl;
+		return -1;
+	}
+	auto qrBox = shapes["qr"].BoundingBox;
+	if (!settings.layoutShapes) {
+		omitLayoutShapes(shapes);
+	}
+
+	auto columns = formColumns(shapes);
+
+	// Expected rows by image and form.
+	map<string, vector<string>> expected;
+	if (!record) {
+		ifstream in(goldenFile, ios::binary);
+		if (!in) {
+			cerr << "Error: Could not read " << goldenFile << endl;
+			return -1;
+		}
+		skipBOM(in);
+
+		vector<string> header, row;
+		if (!parseCsvLine(in, header) || header != columns) {
+			cerr << "Error: " << goldenFile << " was recorded with a different template" << endl;
+			return -1;
+		}
+		while (parseCsvLine(in, row)) {
+			if (row.size() == columns.size()) {
+				expected[formKey(row[0], static_cast<size_t>(atoi(row[1].c_str())))] = row;
+			}
+		}
+	}
+
+	auto images = listImages(imageDirectory);
+	if (images.empty()) {
+		cerr << "Error: No images in " << imageDirectory << endl;
+		return -1;
+	}
+
+	timingsEnabled = true;
+	ScanContext context;
+	context.settings = settings;
+	context.checkThreshold = true;
+	ScanStats scanStats;
+
+	string golden = formatCsvLine(columns);
+	vector<string> row;
+	long forms = 0, missing = 0, extra = 0, bubbles = 0, crossings = 0;
+	double maxDifference = 0;
+	chrono::steady_clock::duration scanning { };
+
+	for (auto&& image : images) {
+		auto start = chrono::steady_clock::now();
+		auto scanned = scanImageFile(context, imageDirectory + "/" + image, pageSize, qrBox, shapes);
+		if (scanned == nullptr) {
+			cerr << "Error: Could not read " << image << endl;
+			continue;
+		}
+		auto& results = *scanned;
+		scanning += chrono::steady_clock::now() - start;
+
+		for (size_t form = 0; form < results.size(); form++) {
+			auto& result = results[form];
+			forms++;
+			scanStats.add(result);
+
+			if (record) {
+				formatFormRow(image, form, result, row);
+				golden += formatCsvLine(row);
+				continue;
+			}
+
+			auto match = expected.find(formKey(image, form));
+			if (match == expected.end()) {
+				cerr << image << " form " << form << ": not in " << goldenFile << endl;
+				extra++;
+				continue;
+			}
+			auto& want = match->second;
+			if (want[2] != result.qrData) {
+				cerr << image << " form " << form << ": QR code " << result.qrData
+						<< ", expected " << want[2] << endl;
+			}
+
+			for (size_t ordinal = 0; ordinal < result.fills.size(); ordinal++) {
+				double fill = result.fills[ordinal];
+				double wanted = atof(want[ordinal + 3].c_str());
+				bubbles++;
+				maxDifference = max(maxDifference, fabs(fill - wanted));
+				if ((fill > FILL_THRESHOLD) != (wanted > FILL_THRESHOLD)) {
+					crossings++;
+					cerr << image << " form " << form << ": " << columns[ordinal + 3] << " "
+							<< fill << ", expected " << wanted << endl;
+				}
+			}
+			expected.erase(match);
+		}
+	}
+
+	// Forms that were expected but not found this time.
+	for (auto&& unmatched : expected) {
+		cerr << unmatched.second[0] << " form " << unmatched.second[1] << ": not found" << endl;
+		missing++;
+	}
+
+	if (record && !replaceFile(goldenFile, golden)) {
+		return -1;
+	}
+
+	double seconds = chrono::duration<double>(scanning).count();
+	printf("images       %zu\n", images.size());
+	printf("forms        %ld\n", forms);
+	printf("sheets/sec   %.2f\n", seconds > 0 ? forms / seconds : 0.0);
+	if (!record) {
+		printf("missing      %ld\n", missing);
+		printf("unexpected   %ld\n", extra);
+		printf("bubbles      %ld\n", bubbles);
+		printf("crossings    %ld\n", crossings);
+		printf("max change   %.4f\n", maxDifference);
+	}
+	scanStats.printThreshold();
+	if (settings.tieredSampling) {
+		scanStats.printEscalated();
+	}
+	printf("\n");
+	fflush(stdout);
+	printTimings(cout);
+
+	return missing == 0 && extra == 0 && crossings == 0 && scanStats.withinTolerance() ? 0 : 1;
+}
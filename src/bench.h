@@ -0,0 +1,63 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "qrcode.h"
+#include "scanner.h"
+#include "sheet.h"
+
+// A template rendered once, from which synthetic sheets are generated.
+struct SheetRenderer {
+	bool load(const std::string svgFile, bool layoutShapes);
+
+	std::string SvgFile;
+	cv::Size PageSize;
+	cv::Rect2f QRBox;
+	std::map<std::string, SVGShape> Shapes;
+	std::vector<BubbleGroup> Groups;
+	cv::Mat Page; // Blank sheet at 150 DPI.
+};
+
+// A generated scan and what was marked on it.
+struct SyntheticSheet {
+	cv::Mat Image;
+	std::string QRData;
+	std::vector<bool> Marked; // By shape ordinal.
+	int QuarterTurns = 0;     // Clockwise, how the sheet was fed.
+};
+
+// Fill random bubbles, print a real QR code, and photograph the sheet: perspective,
+// rotation, uneven lighting, blur and sensor noise. Seeds cycle through the four ways
+// a sheet can be fed, upright, sideways and upside down. The same seed gives the same
+// sheet.
+SyntheticSheet generateSheet(const SheetRenderer& renderer, unsigned seed);
+
+// Scan generated sheets from each template and report throughput, stage latencies
+// and bubble accuracy against the known marks.
+int runBenchmark(const std::vector<std::string>& svgFiles, int sheets, unsigned seed,
+		const ScanSettings& settings);
+
+// Image file names in a directory, sorted so runs are comparable.
+std::vector<std::string> listImages(const std::string& directory);
+
+// Columns of a golden file: image, form, qr_data, then one per shape.
+std::vector<std::string> formColumns(const std::map<std::string, SVGShape>& shapes);
+
+// Row of one form in a golden file, with fills to six decimals.
+void formatFormRow(const std::string& image, size_t form, const ScanResult& result,
+		std::vector<std::string>& outRow);
+
+// Scan every image in a directory of real scans and compare the fills with a golden
+// CSV file (image, form, qr_data, then one column per shape). Reports throughput and
+// every bubble that falls on the other side of FILL_THRESHOLD. With record set the
+// golden file is written from this run instead. Both benchmarks also check the
+// sampled threshold level against full page Otsu.
+int runGoldenBenchmark(const std::string& svgFile, const std::string& imageDirectory,
+		const std::string& goldenFile, bool record, const ScanSettings& settings);
+
+#endif
@@ -0,0 +1,104 @@
+#include "bitpage.h"
+
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+static inline int popcount(uint64_t word) {
+#if defined(_MSC_VER) && defined(_WIN64)
+	return static_cast<int>(__popcnt64(word));
+#elif defined(_MSC_VER)
+	return static_cast<int>(__popcnt(static_cast<uint32_t>(word)) + __popcnt(static_cast<uint32_t>(word >> 32)));
+#else
+	return __builtin_popcountll(word);
+#endif
+}
+
+// Bits [x0, x1) of a word, for 0 <= x0 < x1 <= 64.
+static inline uint64_t bitRange(int x0, int x1) {
+	uint64_t high = x1 == 64 ? ~0ull : (1ull << x1) - 1;
+	return high & ~((1ull << x0) - 1);
+}
+
+// Set pixels of [x0, x1) on one row.
+static long countRow(const uint64_t* row, int x0, int x1) {
+	int first = x0 / 64, last = (x1 - 1) / 64;
+	if (first == last) {
+		return popcount(row[first] & bitRange(x0 % 64, (x1 - 1) % 64 + 1));
+	}
+
+	long count = popcount(row[first] & bitRange(x0 % 64, 64));
+	for (int word = first + 1; word < last; word++) {
+		count += popcount(row[word]);
+	}
+	return count + popcount(row[last] & bitRange(0, (x1 - 1) % 64 + 1));
+}
+
+void clearBits(cv::Size size, BitPage& outPage) {
+	outPage.Width = size.width;
+	outPage.Height = size.height;
+	outPage.WordsPerRow = (size.width + 63) / 64;
+	outPage.Words.assign(outPage.WordsPerRow * size.height, 0);
+}
+
+void packThreshold(const cv::Mat& gray, cv::Point origin, int level, BitPage& page) {
+	for (int y = 0; y < gray.rows; y++) {
+		const uchar* pixels = gray.ptr<uchar>(y);
+		uint64_t* words = page.row(origin.y + y);
+		for (int x = 0; x < gray.cols; ) {
+			// Gather the pixels that fall in one word.
+			int pageX = origin.x + x;
+			int bit = pageX % 64;
+			int count = min(64 - bit, gray.cols - x);
+			uint64_t bits = 0;
+			for (int i = 0; i < count; i++) {
+				bits |= static_cast<uint64_t>(pixels[x + i] <= level) << i;
+			}
+
+			uint64_t& word = words[pageX / 64];
+			word = (word & ~(bitRange(0, count) << bit)) | (bits << bit);
+			x += count;
+		}
+	}
+}
+
+void unpackBits(const BitPage& page, cv::Mat& outImage) {
+	outImage.create(page.Height, page.Width, CV_8UC1);
+	for (int y = 0; y < page.Height; y++) {
+		const uint64_t* words = page.row(y);
+		uchar* pixels = outImage.ptr<uchar>(y);
+		for (int x = 0; x < page.Width; x++) {
+			pixels[x] = (words[x / 64] >> (x % 64)) & 1 ? 255 : 0;
+		}
+	}
+}
+
+long countBits(const BitPage& page, cv::Rect rect) {
+	rect &= cv::Rect(0, 0, page.Width, page.Height);
+	if (rect.width <= 0) {
+		return 0;
+	}
+
+	long count = 0;
+	for (int y = rect.y; y < rect.y + rect.height; y++) {
+		count += countRow(page.row(y), rect.x, rect.x + rect.width);
+	}
+	return count;
+}
+
+double spanFill(const BitPage& page, const vector<PixelSpan>& spans) {
+	long set = 0, area = 0;
+	for (auto&& span : spans) {
+		int x0 = max(span.X0, 0), x1 = min(span.X1, page.Width);
+		if (span.Y < 0 || span.Y >= page.Height || x0 >= x1) {
+			continue;
+		}
+		set += countRow(page.row(span.Y), x0, x1);
+		area += x1 - x0;
+	}
+	return area > 0 ? static_cast<double>(set) / area : 0;
+}
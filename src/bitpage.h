@@ -0,0 +1,45 @@
+#ifndef BITPAGE_H
+#define BITPAGE_H
+
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+// A binary image packed 64 pixels per word. Bit x % 64 of word x / 64 holds pixel x,
+// and the unused bits at the end of each row are zero. A 150 DPI page fits in L2.
+struct BitPage {
+	int Width = 0;
+	int Height = 0;
+	size_t WordsPerRow = 0;
+	std::vector<uint64_t> Words;
+
+	const uint64_t* row(int y) const { return &Words[y * WordsPerRow]; }
+	uint64_t* row(int y) { return &Words[y * WordsPerRow]; }
+};
+
+// A run of pixels [X0, X1) on row Y.
+struct PixelSpan {
+	int Y;
+	int X0;
+	int X1;
+};
+
+// Size the page and clear every bit.
+void clearBits(cv::Size size, BitPage& outPage);
+
+// Threshold a region of the page whose top left corner is origin, setting the bits of
+// pixels at or below level like THRESH_BINARY_INV. Bits outside the region are left
+// alone, so overlapping regions can be packed one after another.
+void packThreshold(const cv::Mat& gray, cv::Point origin, int level, BitPage& page);
+
+// Expand to an 8-bit image of 0 and 255.
+void unpackBits(const BitPage& page, cv::Mat& outImage);
+
+// Number of set pixels within a rectangle, clipped to the page.
+long countBits(const BitPage& page, cv::Rect rect);
+
+// Fraction of the pixels covered by spans that are set. Spans are clipped to the page.
+double spanFill(const BitPage& page, const std::vector<PixelSpan>& spans);
+
+#endif
@@ -0,0 +1,158 @@
+#include "csv.h"
+
+#include <cstdio>
+#include <iostream>
+#include <limits>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// outClosed is false if the input ended inside a quoted field.
+static bool parseCsvFields(istream& in, vector<string>& outFields, bool& outClosed) {
+	string line;
+	if (!getline(in, line)) {
+		return false;
+	}
+
+	outFields.clear();
+	string field;
+	bool quoted = false;
+	for (size_t i = 0; ; i++) {
+		if (i == line.size()) {
+			if (!quoted) {
+				break;
+			}
+			// Quoted newline, continue with the next line.
+			if (!getline(in, line)) {
+				break;
+			}
+			field += '\n';
+			i = static_cast<size_t>(-1);
+			continue;
+		}
+
+		char c = line[i];
+		if (quoted) {
+			if (c == '"' && i + 1 < line.size() && line[i + 1] == '"') {
+				field += '"';
+				i++;
+			} else if (c == '"') {
+				quoted = false;
+			} else {
+				field += c;
+			}
+		} else if (c == '"') {
+			quoted = true;
+		} else if (c == ',') {
+			outFields.push_back(field);
+			field.clear();
+		} else if (c != '\r') {
+			field += c;
+		}
+	}
+	outFields.push_back(field);
+	outClosed = !quoted;
+	return true;
+}
+
+bool parseCsvLine(istream& in, vector<string>& outFields) {
+	bool closed;
+	return parseCsvFields(in, outFields, closed);
+}
+
+bool parseCsvRecord(istream& in, size_t columns, vector<string>& outFields) {
+	for (;;) {
+		streampos start = in.tellg();
+		bool closed;
+		if (!parseCsvFields(in, outFields, closed)) {
+			return false;
+		}
+		if (closed && outFields.size() == columns) {
+			return true;
+		}
+		skipCsvLine(in, start);
+	}
+}
+
+void skipCsvLine(istream& in, streampos start) {
+	in.clear();
+	in.seekg(start);
+	in.ignore(numeric_limits<streamsize>::max(), '\n');
+}
+
+string formatCsvLine(const vector<string>& fields) {
+	string line;
+	for (size_t i = 0; i < fields.size(); i++) {
+		if (i > 0) {
+			line += ',';
+		}
+		if (fields[i].find_first_of(",\"\r\n") == string::npos) {
+			line += fields[i];
+		} else {
+			line += '"';
+			for (char c : fields[i]) {
+				if (c == '"') {
+					line += '"';
+				}
+				line += c;
+			}
+			line += '"';
+		}
+	}
+	line += '\n';
+	return line;
+}
+
+void skipBOM(istream& in) {
+	char bom[3] = { };
+	in.read(bom, 3);
+	if (!(in.gcount() == 3 && bom[0] == '\xef' && bom[1] == '\xbb' && bom[2] == '\xbf')) {
+		in.clear();
+		in.seekg(0);
+	}
+}
+
+bool syncFile(FILE* file) {
+	if (fflush(file) != 0) {
+		return false;
+	}
+#ifdef _WIN32
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+bool replaceFile(const string path, const string& contents) {
+	string tempPath = path + ".temp";
+	FILE* out = fopen(tempPath.c_str(), "wb");
+	if (out == nullptr) {
+		cerr << "Error: Could not open " << tempPath << endl;
+		return false;
+	}
+
+	// The contents must be on disk before the rename makes them the file, or a crash
+	// could leave an empty file in place of the old one.
+	bool written = fwrite(contents.data(), 1, contents.size(), out) == contents.size()
+			&& syncFile(out);
+	written = fclose(out) == 0 && written;
+
+#ifdef _WIN32
+	// rename() does not replace files on Windows.
+	bool replaced = written && MoveFileExA(tempPath.c_str(), path.c_str(),
+			MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	bool replaced = written && rename(tempPath.c_str(), path.c_str()) == 0;
+#endif
+	if (!replaced) {
+		cerr << "Error: Could not write " << path << endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,34 @@
+#ifndef CSV_H
+#define CSV_H
+
+#include <cstdio>
+#include <istream>
+#include <string>
+#include <vector>
+
+// Read one CSV record, which may span lines if a field is quoted.
+bool parseCsvLine(std::istream& in, std::vector<std::string>& outFields);
+
+// Read the next record with the given number of fields from a file that records are
+// appended to. A record torn by a crash is skipped, and if it ended inside a quoted
+// field, the rows that field ran into are read again instead of being lost with it.
+bool parseCsvRecord(std::istream& in, size_t columns, std::vector<std::string>& outFields);
+
+// Skip to the line after the one the record read from start began on, e.g. after the
+// record turned out to be torn.
+void skipCsvLine(std::istream& in, std::streampos start);
+
+// Format a CSV record including the trailing newline.
+std::string formatCsvLine(const std::vector<std::string>& fields);
+
+// Skip the UTF-8 byte order mark Excel puts at the start of CSV files.
+void skipBOM(std::istream& in);
+
+// Write a file's buffered data through to the disk, or the file server.
+bool syncFile(FILE* file);
+
+// Replace a file with new contents by writing a temporary file and renaming it,
+// so readers never see a partial file.
+bool replaceFile(const std::string path, const std::string& contents);
+
+#endif
@@ -0,0 +1,181 @@
+#include "decode.h"
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+using namespace std;
+
+bool loadFieldSchema(const string filename, const vector<BubbleGroup>& groups,
+		FieldSchema& outSchema) {
+	ifstream file(filename);
+	if (!file) {
+		cerr << "Error: Could not open " << filename << endl;
+		return false;
+	}
+
+	map<string, size_t> groupIndex;
+	for (size_t i = 0; i < groups.size(); i++) {
+		groupIndex[groups[i].Name] = i;
+	}
+
+	FieldSchema schema { groups, { } };
+	string line;
+	int lineNumber = 0;
+
+	while (getline(file, line)) {
+		lineNumber++;
+		istringstream tokens(line);
+		string name, kind;
+		if (!(tokens >> name) || name[0] == '#' || name == "check" || name == "stats") {
+			continue;
+		}
+		tokens >> kind;
+
+		FieldSpec field { name, FieldKind::QRData, "", { } };
+		if (kind == "option" || kind == "number") {
+			field.Kind = kind == "option" ? FieldKind::Option : FieldKind::Number;
+			tokens >> field.Default;
+			if (field.Default == "-") {
+				field.Default.clear();
+			}
+
+			string group;
+			while (tokens >> group) {
+				auto found = groupIndex.find(group);
+				if (found == groupIndex.end()) {
+					cerr << "Error: " << filename << ":" << lineNumber
+							<< ": no bubbles named " << group << ".*" << endl;
+					return false;
+				}
+				field.Groups.push_back(found->second);
+			}
+
+			if (field.Groups.empty()
+					|| (field.Kind == FieldKind::Option && field.Groups.size() != 1)) {
+				cerr << "Error: " << filename << ":" << lineNumber
+						<< ": wrong number of groups for " << name << endl;
+				return false;
+			}
+			if (field.Kind == FieldKind::Number) {
+				for (auto index : field.Groups) {
+					if (!groups[index].Digits) {
+						cerr << "Warning: " << filename << ":" << lineNumber << ": " << groups[index].Name
+								<< " has options that aren't digits, " << name << " ignores them" << endl;
+					}
+				}
+			}
+		} else if (kind != "qr") {
+			cerr << "Error: " << filename << ":" << lineNumber
+					<< ": unknown field kind '" << kind << "'" << endl;
+			return false;
+		}
+
+		schema.Fields.push_back(field);
+	}
+
+	outSchema = schema;
+	return true;
+}
+
+GroupDecision decideGroup(const float* fills, size_t count) {
+	// Running top two in one pass over the few options of a group.
+	float best = -1, second = -1;
+	size_t bestIndex = 0;
+	size_t marked = 0;
+	for (size_t i = 0; i < count; i++) {
+		float fill = fills[i];
+		bool better = fill > best;
+		second = better ? best : max(second, fill);
+		bestIndex = better ? i : bestIndex;
+		best = better ? fill : best;
+		marked += fill > FILL_THRESHOLD ? 1 : 0;
+	}
+
+	GroupDecision decision { -1, max(best, 0.0f), max(best - max(second, 0.0f), 0.0f), marked > 1 };
+	if (marked > 0) {
+		decision.Choice = static_cast<int>(bestIndex);
+	}
+	return decision;
+}
+
+void decideGroups(const vector<BubbleGroup>& groups, const vector<float>& fills,
+		vector<GroupDecision>& outDecisions) {
+	outDecisions.resize(groups.size());
+	for (size_t i = 0; i < groups.size(); i++) {
+		outDecisions[i] = decideGroup(&fills[groups[i].First], groups[i].Ordinals.size());
+	}
+}
+
+// Find the darkest option of a group, or -1 if none is marked.
+// Ties go to the first option, and only options accepted by the filter are considered.
+template <typename Filter>
+static int darkestOption(const BubbleGroup& group, const vector<float>& fills,
+		Filter accept) {
+	int best = -1;
+	double bestFill = FILL_THRESHOLD;
+	for (size_t i = 0; i < group.Ordinals.size(); i++) {
+		double fill = fills[group.Ordinals[i]];
+		if (fill > bestFill && accept(group.Options[i])) {
+			best = static_cast<int>(i);
+			bestFill = fill;
+		}
+	}
+	return best;
+}
+
+static bool isDigit(const string& option) {
+	return option.size() == 1 && option[0] >= '0' && option[0] <= '9';
+}
+
+vector<DecodedField> decodeRecord(const FieldSchema& schema,
+		const vector<float>& fills, const string& qrData) {
+	vector<DecodedField> record;
+	record.reserve(schema.Fields.size());
+
+	for (auto&& field : schema.Fields) {
+		DecodedField decoded { field.Default, false };
+
+		switch (field.Kind) {
+		case FieldKind::QRData:
+			decoded = { qrData, true };
+			break;
+
+		case FieldKind::Option: {
+			auto& group = schema.Groups[field.Groups[0]];
+			int best = decideGroup(&fills[group.First], group.Ordinals.size()).Choice;
+			if (best >= 0) {
+				decoded = { group.Options[best], true };
+			}
+			break;
+		}
+
+		case FieldKind::Number: {
+			string digits;
+			for (auto index : field.Groups) {
+				// Groups with stray options, which loading the schema warns about, are
+				// decided among their digits only.
+				auto& group = schema.Groups[index];
+				int best = group.Digits
+						? decideGroup(&fills[group.First], group.Ordinals.size()).Choice
+						: darkestOption(group, fills, isDigit);
+				if (best >= 0) {
+					digits += group.Options[best];
+				}
+			}
+
+			if (!digits.empty()) {
+				// Drop leading zeros like int() does, keeping a lone "0".
+				auto first = min(digits.find_first_not_of('0'), digits.size() - 1);
+				decoded = { digits.substr(first), true };
+			}
+			break;
+		}
+		}
+
+		record.push_back(decoded);
+	}
+
+	return record;
+}
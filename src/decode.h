@@ -0,0 +1,66 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <string>
+#include <vector>
+
+#include "sheet.h"
+
+// Fill fraction above which a bubble counts as marked.
+const double FILL_THRESHOLD = 0.3;
+
+enum class FieldKind {
+	QRData, // Text of the QR code, e.g. the competition name.
+	Option, // Name of the darkest marked option in a group.
+	Number  // Digits of several groups concatenated into a number.
+};
+
+struct FieldSpec {
+	std::string Name;
+	FieldKind Kind;
+	std::string Default;
+	std::vector<size_t> Groups; // Indices into FieldSchema::Groups
+};
+
+// Describes how the bubble groups of a sheet are decoded into record fields.
+struct FieldSchema {
+	std::vector<BubbleGroup> Groups;
+	std::vector<FieldSpec> Fields;
+};
+
+// Load a field schema and resolve it against the bubble groups of a template.
+// Each non-comment line has the form
+//   name qr
+//   name option default group
+//   name number default group...
+// where a default of "-" means an empty value. Lines starting with "check" are
+// validation rules, see validate.h, and "stats" lines are read by aggregate.h.
+bool loadFieldSchema(const std::string filename, const std::vector<BubbleGroup>& groups,
+		FieldSchema& outSchema);
+
+// The choice made in a group of mutually exclusive bubbles.
+struct GroupDecision {
+	int Choice;   // Index of the darkest marked option, or -1 if the group is blank.
+	float Fill;   // Fill of the darkest option.
+	float Margin; // Darkest minus second darkest fill, the confidence of the choice.
+	bool Multiple; // More than one option is marked.
+};
+
+// Decide a group from its contiguous fills. Ties go to the first option.
+GroupDecision decideGroup(const float* fills, size_t count);
+
+// Decide every group of a template.
+void decideGroups(const std::vector<BubbleGroup>& groups, const std::vector<float>& fills,
+		std::vector<GroupDecision>& outDecisions);
+
+struct DecodedField {
+	std::string Text;
+	bool Marked; // False if the field fell back to its default.
+};
+
+// Decode one sheet. The result has one entry per schema field, in schema order.
+// Fills are indexed by shape ordinal, see shapeIds().
+std::vector<DecodedField> decodeRecord(const FieldSchema& schema,
+		const std::vector<float>& fills, const std::string& qrData);
+
+#endif
@@ -0,0 +1,276 @@
+#include "framering.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <opencv2/imgcodecs.hpp>
+
+using namespace std;
+
+// Identifies a ring and its layout version.
+const uint32_t RING_MAGIC = 0x50534632; // "PSF2"
+
+// How often a reader polls for new frames.
+const chrono::milliseconds POLL_INTERVAL(1);
+
+// How often a waiting reader checks that the writer is still running.
+const chrono::seconds LIVENESS_INTERVAL(1);
+
+// How often replayFrames() publishes a frame.
+const chrono::milliseconds REPLAY_INTERVAL(200);
+
+// The start of the shared memory, followed by the slots and then the frame pixels.
+// Both processes see this layout, so it only holds fixed size, lock-free members.
+struct FrameRing::Header {
+	uint32_t Magic;
+	uint32_t Slots;
+	uint32_t MaxWidth;
+	uint32_t MaxHeight;
+	uint32_t WriterPid;
+	atomic<uint64_t> Published; // Frames written so far.
+	atomic<uint32_t> Finished;
+};
+
+struct FrameRing::Slot {
+	atomic<uint64_t> Sequence; // 2 * frame + 1 while written, 2 * frame + 2 once written.
+	uint32_t Width;
+	uint32_t Height;
+};
+
+// The slots and the pixels start on cache lines of their own.
+size_t FrameRing::slotsOffset() {
+	return (sizeof(Header) + 63) & ~size_t(63);
+}
+
+size_t FrameRing::pixelsOffset(size_t slots) {
+	return (slotsOffset() + slots * sizeof(Slot) + 63) & ~size_t(63);
+}
+
+FrameRing::~FrameRing() {
+#ifndef _WIN32
+	if (memory != nullptr) {
+		munmap(memory, mappedBytes);
+	}
+	if (owner) {
+		shm_unlink(name.c_str());
+	}
+#endif
+}
+
+FrameRing::Slot& FrameRing::slot(uint64_t frame) const {
+	auto slots = reinterpret_cast<Slot*>(static_cast<char*>(memory) + slotsOffset());
+	return slots[frame % header->Slots];
+}
+
+unsigned char* FrameRing::pixels(uint64_t frame) const {
+	size_t frameBytes = static_cast<size_t>(header->MaxWidth) * header->MaxHeight;
+	return static_cast<unsigned char*>(memory) + pixelsOffset(header->Slots)
+			+ (frame % header->Slots) * frameBytes;
+}
+
+#ifdef _WIN32
+
+bool FrameRing::create(const string& name, int slots, cv::Size maxSize) {
+	cerr << "Error: Shared memory frame rings are not supported on Windows" << endl;
+	return false;
+}
+
+bool FrameRing::open(const string& name) {
+	return create(name, 0, { });
+}
+
+bool FrameRing::map(int fd, size_t bytes) {
+	return false;
+}
+
+bool FrameRing::writerAlive() const {
+	return true;
+}
+
+#else
+
+bool FrameRing::map(int fd, size_t bytes) {
+	memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (memory == MAP_FAILED) {
+		memory = nullptr;
+		return false;
+	}
+	mappedBytes = bytes;
+	header = static_cast<Header*>(memory);
+	return true;
+}
+
+bool FrameRing::create(const string& name, int slots, cv::Size maxSize) {
+	if (slots <= 0 || maxSize.area() <= 0) {
+		cerr << "Error: Invalid frame ring size" << endl;
+		return false;
+	}
+
+	size_t bytes = pixelsOffset(slots) + static_cast<size_t>(slots) * maxSize.area();
+
+	shm_unlink(name.c_str());
+	int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0 || ftruncate(fd, bytes) != 0 || !map(fd, bytes)) {
+		cerr << "Error: Could not create frame ring " << name << endl;
+		if (fd >= 0) {
+			shm_unlink(name.c_str());
+		}
+		return false;
+	}
+	this->name = name;
+	owner = true;
+
+	// The new memory is zeroed, so every slot starts out empty.
+	header->Slots = slots;
+	header->MaxWidth = maxSize.width;
+	header->MaxHeight = maxSize.height;
+	header->WriterPid = static_cast<uint32_t>(getpid());
+	header->Published.store(0, memory_order_relaxed);
+	header->Finished.store(0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	header->Magic = RING_MAGIC;
+	return true;
+}
+
+bool FrameRing::open(const string& name) {
+	int fd = shm_open(name.c_str(), O_RDWR, 0);
+	struct stat status;
+	if (fd < 0 || fstat(fd, &status) != 0 || !map(fd, status.st_size)) {
+		cerr << "Error: Could not open frame ring " << name << endl;
+		return false;
+	}
+	if (mappedBytes < sizeof(Header) || header->Magic != RING_MAGIC
+			|| mappedBytes < pixelsOffset(header->Slots)
+					+ static_cast<size_t>(header->Slots) * header->MaxWidth * header->MaxHeight) {
+		cerr << "Error: " << name << " is not a frame ring" << endl;
+		return false;
+	}
+	this->name = name;
+	nextFrame = header->Published.load(memory_order_acquire);
+	return true;
+}
+
+bool FrameRing::writerAlive() const {
+	// Signal 0 only checks that the process exists; EPERM means it belongs to another user.
+	return kill(static_cast<pid_t>(header->WriterPid), 0) == 0 || errno != ESRCH;
+}
+
+#endif
+
+bool FrameRing::publish(const cv::Mat& gray) {
+	if (gray.type() != CV_8UC1 || gray.cols > static_cast<int>(header->MaxWidth)
+			|| gray.rows > static_cast<int>(header->MaxHeight)) {
+		cerr << "Error: Frame does not fit the frame ring" << endl;
+		return false;
+	}
+
+	uint64_t frame = header->Published.load(memory_order_relaxed);
+	auto& target = slot(frame);
+	target.Sequence.store(2 * frame + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	target.Width = gray.cols;
+	target.Height = gray.rows;
+	cv::Mat pixels(gray.rows, gray.cols, CV_8UC1, this->pixels(frame));
+	gray.copyTo(pixels);
+
+	target.Sequence.store(2 * frame + 2, memory_order_release);
+	header->Published.store(frame + 1, memory_order_release);
+	return true;
+}
+
+void FrameRing::finish() {
+	header->Finished.store(1, memory_order_release);
+}
+
+bool FrameRing::next(cv::Mat& outFrame) {
+	auto lastLivenessCheck = chrono::steady_clock::now();
+	for (;;) {
+		// Check finished first, so frames published just before finishing are read.
+		bool finished = header->Finished.load(memory_order_acquire) != 0;
+		uint64_t published = header->Published.load(memory_order_acquire);
+
+		if (nextFrame < published) {
+			// Skip the frames the writer has already come round to again.
+			if (published - nextFrame > header->Slots - 1) {
+				uint64_t oldest = published - (header->Slots - 1);
+				skippedFrames += oldest - nextFrame;
+				nextFrame = oldest;
+			}
+
+			uint64_t frame = nextFrame++;
+			auto& source = slot(frame);
+			readSequence = source.Sequence.load(memory_order_acquire);
+			if (readSequence != 2 * frame + 2) {
+				skippedFrames++; // Overwritten while we looked.
+				continue;
+			}
+			outFrame = cv::Mat(source.Height, source.Width, CV_8UC1, pixels(frame));
+			return true;
+		}
+
+		if (finished) {
+			return false;
+		}
+		if (chrono::steady_clock::now() - lastLivenessCheck >= LIVENESS_INTERVAL) {
+			if (!writerAlive()) {
+				cerr << "Error: The capture process writing " << name << " exited without finishing it" << endl;
+				return false;
+			}
+			lastLivenessCheck = chrono::steady_clock::now();
+		}
+		this_thread::sleep_for(POLL_INTERVAL);
+	}
+}
+
+bool FrameRing::intact() const {
+	atomic_thread_fence(memory_order_acquire);
+	return slot(nextFrame - 1).Sequence.load(memory_order_relaxed) == readSequence;
+}
+
+int replayFrames(const string& ringName, const vector<string>& imageFiles) {
+	vector<cv::Mat> frames;
+	cv::Size maxSize;
+	for (auto&& file : imageFiles) {
+		cv::Mat frame = cv::imread(file, cv::IMREAD_GRAYSCALE);
+		if (frame.empty()) {
+			cerr << "Error: Could not read " << file << endl;
+			return -1;
+		}
+		maxSize.width = max(maxSize.width, frame.cols);
+		maxSize.height = max(maxSize.height, frame.rows);
+		frames.push_back(frame);
+	}
+
+	FrameRing ring;
+	if (!ring.create(ringName, 4, maxSize)) {
+		return -1;
+	}
+
+	// Give readers a moment to attach before the first frame.
+	this_thread::sleep_for(REPLAY_INTERVAL);
+	for (auto&& frame : frames) {
+		if (!ring.publish(frame)) {
+			return -1;
+		}
+		this_thread::sleep_for(REPLAY_INTERVAL);
+	}
+	ring.finish();
+
+	// Keep the ring around until readers have had time to see the last frames.
+	this_thread::sleep_for(REPLAY_INTERVAL * 5);
+	return 0;
+}
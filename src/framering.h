@@ -0,0 +1,81 @@
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+// A ring of 8-bit grayscale frames in POSIX shared memory. A capture process writes
+// frames into it and the scanner reads them in place, so frames are never copied or
+// re-encoded between processes. There is one writer per ring; a reader that falls a
+// whole ring behind skips to the oldest frame still in it.
+//
+// Each slot carries a sequence number that is odd while the writer fills it. A reader
+// checks it before and after using a frame, see intact(), to catch a frame that was
+// overwritten while it was being scanned.
+//
+// The ring records the process ID of its writer, so a reader stops waiting once the
+// writer has exited without finishing the ring. Both must see the same process IDs.
+class FrameRing {
+public:
+	FrameRing() = default;
+	~FrameRing();
+
+	FrameRing(const FrameRing&) = delete;
+	FrameRing& operator=(const FrameRing&) = delete;
+
+	// Writer: create the ring, replacing one with the same name. Frames may be up to
+	// maxSize, larger ones are rejected by publish().
+	bool create(const std::string& name, int slots, cv::Size maxSize);
+
+	// Reader: attach to a ring created by a capture process.
+	bool open(const std::string& name);
+
+	// Writer: copy a frame into the next slot and make it visible to readers.
+	bool publish(const cv::Mat& gray);
+
+	// Writer: tell readers that no more frames will come.
+	void finish();
+
+	// Reader: wait for the next frame and wrap it without copying. The frame stays
+	// valid until the writer comes round to its slot again. Returns false once the
+	// writer has finished and every remaining frame was read, or has exited.
+	bool next(cv::Mat& outFrame);
+
+	// Reader: whether the frame last returned by next() was not overwritten since.
+	bool intact() const;
+
+	// Reader: frames skipped because the reader fell behind.
+	uint64_t skipped() const { return skippedFrames; }
+
+private:
+	struct Header;
+	struct Slot;
+
+	static size_t slotsOffset();
+	static size_t pixelsOffset(size_t slots);
+
+	bool map(int fd, size_t bytes);
+	bool writerAlive() const;
+	Slot& slot(uint64_t frame) const;
+	unsigned char* pixels(uint64_t frame) const;
+
+	std::string name;
+	bool owner = false;
+	void* memory = nullptr;
+	size_t mappedBytes = 0;
+	Header* header = nullptr;
+
+	uint64_t nextFrame = 0;    // Reader: frame number to read next.
+	uint64_t readSequence = 0; // Reader: sequence of the slot when it was read.
+	uint64_t skippedFrames = 0;
+};
+
+// Stand-in for a capture process: publish each image file into a new ring a few
+// times a second, then finish the ring.
+int replayFrames(const std::string& ringName, const std::vector<std::string>& imageFiles);
+
+#endif
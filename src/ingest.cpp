@@ -0,0 +1,127 @@
+#include "ingest.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include <opencv2/imgcodecs.hpp>
+
+#include "timing.h"
+
+using namespace std;
+
+bool parseDetectScale(const string& name, int& outScale) {
+	int scale = atoi(name.c_str());
+	if (name != to_string(scale) || (scale != 1 && scale != 2 && scale != 4 && scale != 8)) {
+		return false;
+	}
+	outScale = scale;
+	return true;
+}
+
+static int readFlags(int scale) {
+	switch (scale) {
+	case 2: return cv::IMREAD_REDUCED_GRAYSCALE_2;
+	case 4: return cv::IMREAD_REDUCED_GRAYSCALE_4;
+	case 8: return cv::IMREAD_REDUCED_GRAYSCALE_8;
+	default: return cv::IMREAD_GRAYSCALE;
+	}
+}
+
+static cv::Mat decodeAt(const ImageDecoder& decode, int scale) {
+	StageTimer timer(Stage::ImageLoad);
+	return decode(readFlags(scale));
+}
+
+// The coarsest scale, up to maxScale, at which every QR code found still covers at least
+// as many pixels as it does in the template.
+static int sampleScale(const vector<FormCode>& codes, const cv::Rect2f qrBox, int maxScale) {
+	double pixels = 1e9;
+	for (auto&& code : codes) {
+		double side = 0;
+		for (int i = 0; i < 4; i++) {
+			cv::Point2f edge = code.Corners[(i + 1) % 4] - code.Corners[i];
+			side += sqrt(edge.dot(edge)) / 4;
+		}
+		pixels = min(pixels, side / max(qrBox.width, qrBox.height));
+	}
+
+	int scale = maxScale;
+	while (scale > 1 && pixels / scale < 1) {
+		scale /= 2;
+	}
+	return scale;
+}
+
+// Whether an encoded image starts with the JPEG start of image marker.
+static bool isJpeg(const unsigned char* head, size_t size) {
+	return size >= 3 && head[0] == 0xFF && head[1] == 0xD8 && head[2] == 0xFF;
+}
+
+vector<ScanResult>* scanDecoded(ScanContext& context, const ImageDecoder& decode, bool jpeg,
+		const cv::Size pageSize, const cv::Rect2f qrBox,
+		const map<string, SVGShape>& shapes) {
+	int detectScale = jpeg ? context.settings.detectScale : 1;
+	if (detectScale <= 1) {
+		cv::Mat rawImage = decodeAt(decode, 1);
+		if (rawImage.empty()) {
+			return nullptr;
+		}
+		auto& results = scanImage(context, rawImage, pageSize, qrBox, shapes);
+		context.lastCodes = context.codes.size();
+		return &results;
+	}
+
+	cv::Mat reduced = decodeAt(decode, detectScale);
+	if (reduced.empty()) {
+		return nullptr;
+	}
+	size_t found = findCodes(context, reduced, static_cast<float>(detectScale));
+	if (found == 0 || found < context.lastCodes) {
+		// A QR code may be too small to read at the reduced scale, so with fewer codes
+		// than the last image had, look again in the full image.
+		cv::Mat rawImage = decodeAt(decode, 1);
+		if (rawImage.empty()) {
+			return nullptr;
+		}
+		size_t fullFound = findCodes(context, rawImage, 1);
+		if (fullFound >= found) {
+			if (fullFound > found) {
+				cerr << "Warning: " << fullFound - found << " of " << fullFound
+					<< " QR codes were only found at full resolution, try a smaller --detect-scale" << endl;
+			}
+			context.lastCodes = fullFound;
+			return &scanForms(context, rawImage, 1, pageSize, qrBox, shapes);
+		}
+		findCodes(context, reduced, static_cast<float>(detectScale));
+	}
+	context.lastCodes = found;
+
+	int scale = sampleScale(context.codes, qrBox, detectScale);
+	cv::Mat sampled = scale == detectScale ? reduced : decodeAt(decode, scale);
+	if (sampled.empty()) {
+		return nullptr;
+	}
+	return &scanForms(context, sampled, static_cast<float>(scale), pageSize, qrBox, shapes);
+}
+
+vector<ScanResult>* scanImageFile(ScanContext& context, const string& path,
+		const cv::Size pageSize, const cv::Rect2f qrBox,
+		const map<string, SVGShape>& shapes) {
+	unsigned char head[3] = { };
+	size_t headSize = 0;
+	if (FILE* file = fopen(path.c_str(), "rb")) {
+		headSize = fread(head, 1, sizeof(head), file);
+		fclose(file);
+	}
+	auto decode = [&](int flags) { return cv::imread(path, flags); };
+	return scanDecoded(context, decode, isJpeg(head, headSize), pageSize, qrBox, shapes);
+}
+
+vector<ScanResult>* scanImageBytes(ScanContext& context, const vector<unsigned char>& bytes,
+		const cv::Size pageSize, const cv::Rect2f qrBox,
+		const map<string, SVGShape>& shapes) {
+	auto decode = [&](int flags) { return cv::imdecode(bytes, flags); };
+	return scanDecoded(context, decode, isJpeg(bytes.data(), bytes.size()), pageSize, qrBox, shapes);
+}
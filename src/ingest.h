@@ -0,0 +1,40 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "scanner.h"
+#include "sheet.h"
+
+// Parse the scale QR codes are found at: 1, 2, 4 or 8.
+bool parseDetectScale(const std::string& name, int& outScale);
+
+// Decodes an image with the given cv::IMREAD_* flags.
+typedef std::function<cv::Mat(int flags)> ImageDecoder;
+
+// Scan an image, decoding it no larger than needed. QR codes in a JPEG are found in a
+// copy decoded at 1 / ScanSettings::detectScale resolution, which JPEG decodes cheaply
+// by scaling the DCT. The forms are then registered and sampled at the coarsest scale
+// that still has a source pixel for every template pixel, judged by the size of the QR
+// codes, so a 24 MP phone photo of a sheet is usually never decoded in full. If fewer
+// QR codes are found at the reduced scale than in the context's last image, or none,
+// the full image is tried. Other formats are always decoded in full, reducing them
+// would only add a resize. Returns nullptr if the image can't be decoded.
+std::vector<ScanResult>* scanDecoded(ScanContext& context, const ImageDecoder& decode, bool jpeg,
+		const cv::Size pageSize, const cv::Rect2f qrBox,
+		const std::map<std::string, SVGShape>& shapes);
+
+std::vector<ScanResult>* scanImageFile(ScanContext& context, const std::string& path,
+		const cv::Size pageSize, const cv::Rect2f qrBox,
+		const std::map<std::string, SVGShape>& shapes);
+
+std::vector<ScanResult>* scanImageBytes(ScanContext& context, const std::vector<unsigned char>& bytes,
+		const cv::Size pageSize, const cv::Rect2f qrBox,
+		const std::map<std::string, SVGShape>& shapes);
+
+#endif
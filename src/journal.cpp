@@ -0,0 +1,124 @@
+#include "journal.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "csv.h"
+
+using namespace std;
+
+// Images per commit, and the longest a completed image waits to be committed. Each
+// commit costs two syncs, so batching keeps them from dominating fast runs.
+const size_t COMMIT_IMAGES = 32;
+const chrono::seconds COMMIT_INTERVAL(2);
+
+static bool truncateFile(FILE* file, long size) {
+#ifdef _WIN32
+	return _chsize_s(_fileno(file), size) == 0;
+#else
+	return ftruncate(fileno(file), size) == 0;
+#endif
+}
+
+Journal::~Journal() {
+	if (journal != nullptr) {
+		fclose(journal);
+	}
+	if (out != nullptr) {
+		fclose(out);
+	}
+}
+
+bool Journal::open(const string& journalPath, const string& outputPath) {
+	this->journalPath = journalPath;
+	this->outputPath = outputPath;
+
+	// Only lines with their newline were committed.
+	long committedBytes = 0;
+	{
+		ifstream in(journalPath, ios::binary);
+		string contents((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+		contents.erase(contents.rfind('\n') == string::npos ? 0 : contents.rfind('\n') + 1);
+
+		istringstream lines(contents);
+		vector<string> row;
+		while (parseCsvRecord(lines, 3, row)) {
+			done.insert(row[0]);
+			committedBytes = atol(row[1].c_str());
+			committedRecords = atol(row[2].c_str());
+		}
+	}
+	records = committedRecords;
+
+	// Roll the output back to the last commit. Without committed records, start over.
+	out = fopen(outputPath.c_str(), "ab");
+	if (out == nullptr || !truncateFile(out, committedRecords > 0 ? committedBytes : 0)) {
+		cerr << "Error: Could not open " << outputPath << endl;
+		return false;
+	}
+
+	journal = fopen(journalPath.c_str(), "ab");
+	if (journal == nullptr) {
+		cerr << "Error: Could not open " << journalPath << endl;
+		return false;
+	}
+	fseek(journal, 0, SEEK_END);
+	if (ftell(journal) > 0) {
+		// End a line cut short by a crash, it isn't read back.
+		ifstream in(journalPath, ios::binary);
+		in.seekg(-1, ios::end);
+		if (in.get() != '\n') {
+			fputc('\n', journal);
+		}
+	}
+
+	lastCommit = chrono::steady_clock::now();
+	return true;
+}
+
+void Journal::add(const string& image, long records) {
+	pending.push_back(image);
+	this->records += records;
+}
+
+bool Journal::commitDue() const {
+	return pending.size() >= COMMIT_IMAGES
+			|| (!pending.empty() && chrono::steady_clock::now() - lastCommit >= COMMIT_INTERVAL);
+}
+
+bool Journal::commit() {
+	lastCommit = chrono::steady_clock::now();
+	if (pending.empty()) {
+		return true;
+	}
+
+	// The records must be on disk before the journal says they are.
+	fseek(out, 0, SEEK_END);
+	long bytes = ftell(out);
+	if (!syncFile(out)) {
+		cerr << "Error: Could not write " << outputPath << endl;
+		return false;
+	}
+
+	string lines;
+	for (auto&& image : pending) {
+		lines += formatCsvLine({ image, to_string(bytes), to_string(records) });
+		done.insert(image);
+	}
+	pending.clear();
+	committedRecords = records;
+
+	if (fwrite(lines.data(), 1, lines.size(), journal) != lines.size() || !syncFile(journal)) {
+		cerr << "Error: Could not write " << journalPath << endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,62 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Progress of a batch run, so a run that was cut short can be restarted without
+// scanning images twice or writing their records twice.
+//
+// The journal owns the output file. Completed images are committed in batches: the
+// output is synced first, then a line per image with the output size and record count
+// is appended to the journal and synced. On open the output is cut back to the size of
+// the last committed image, dropping records of images that weren't committed, and
+// those images are scanned again. Lines cut short by a crash are ignored.
+class Journal {
+public:
+	Journal() = default;
+	~Journal();
+
+	Journal(const Journal&) = delete;
+	Journal& operator=(const Journal&) = delete;
+
+	// Open or create the journal and its output file, rolling the output back to the
+	// last commit.
+	bool open(const std::string& journalPath, const std::string& outputPath);
+
+	// File the records are written to.
+	FILE* output() const { return out; }
+
+	// Whether the output already holds records, so headers mustn't be written again.
+	bool resumed() const { return committedRecords > 0; }
+
+	bool isDone(const std::string& image) const { return done.count(image) > 0; }
+	size_t doneCount() const { return done.size(); }
+
+	// Record that the given number of records of an image have been written.
+	void add(const std::string& image, long records);
+
+	// Whether enough images or time have gone by to commit a batch.
+	bool commitDue() const;
+
+	// Sync the output and then the journal lines of every image added since the last
+	// commit. Flush the writer first.
+	bool commit();
+
+private:
+	std::string journalPath;
+	std::string outputPath;
+	FILE* journal = nullptr;
+	FILE* out = nullptr;
+
+	std::unordered_set<std::string> done;
+	std::vector<std::string> pending;
+	long committedRecords = 0;
+	long records = 0;
+	std::chrono::steady_clock::time_point lastCommit;
+};
+
+#endif
@@ -0,0 +1,219 @@
+#include "matchstore.h"
+
+#include "csv.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+const char* const KEY_COLUMNS[] = { "competition", "match", "team" };
+
+// Don't bother compacting logs smaller than this.
+const size_t MIN_COMPACT_ROWS = 256;
+
+MatchStore::~MatchStore() {
+	if (log != nullptr) {
+		fclose(log);
+	}
+}
+
+bool MatchStore::open(const string logPath, const vector<string>& columns) {
+	this->logPath = logPath;
+	if (!columns.empty() && !setColumns(columns)) {
+		return false;
+	}
+
+	// Replay the existing log.
+	ifstream in(logPath, ios::binary);
+	vector<string> row;
+	if (!in || !parseCsvLine(in, row)) {
+		return true;
+	}
+
+	if (this->columns.empty()) {
+		if (!setColumns(row)) {
+			return false;
+		}
+	} else if (row != this->columns) {
+		cerr << "Error: " << logPath << " has different columns" << endl;
+		return false;
+	}
+
+	while (parseCsvRecord(in, this->columns.size(), row)) {
+		logRows++;
+		auto key = keyOf(row);
+		auto found = index.find(key);
+		if (found == index.end()) {
+			index.emplace(key, rows.size());
+			rows.push_back(row);
+		} else {
+			rows[found->second] = row;
+		}
+	}
+	in.close();
+
+	if (logRows >= MIN_COMPACT_ROWS && logRows > 2 * rows.size()) {
+		return compact();
+	}
+	return true;
+}
+
+bool MatchStore::setColumns(const vector<string>& columns) {
+	for (size_t i = 0; i < 3; i++) {
+		auto found = std::find(columns.begin(), columns.end(), KEY_COLUMNS[i]);
+		if (found == columns.end()) {
+			cerr << "Error: match store needs a " << KEY_COLUMNS[i] << " column" << endl;
+			return false;
+		}
+		keyColumns[i] = found - columns.begin();
+	}
+
+	this->columns = columns;
+	return true;
+}
+
+string MatchStore::keyOf(const vector<string>& row) const {
+	return row[keyColumns[0]] + '\x1f' + row[keyColumns[1]] + '\x1f' + row[keyColumns[2]];
+}
+
+const vector<string>* MatchStore::find(const vector<string>& row) const {
+	auto found = index.find(keyOf(row));
+	return found == index.end() ? nullptr : &rows[found->second];
+}
+
+bool MatchStore::put(const vector<string>& row, bool overwrite, PutResult& outResult) {
+	if (columns.empty() || row.size() != columns.size()) {
+		return false;
+	}
+
+	auto key = keyOf(row);
+	auto found = index.find(key);
+	if (found != index.end() && !overwrite) {
+		outResult = PutResult::Duplicate;
+		return true;
+	}
+
+	// Only records that reached the log are kept, so memory never has records that
+	// would be gone after a restart.
+	if (!append(row)) {
+		return false;
+	}
+	if (found == index.end()) {
+		index.emplace(key, rows.size());
+		rows.push_back(row);
+		outResult = PutResult::Added;
+	} else {
+		rows[found->second] = row;
+		outResult = PutResult::Overwritten;
+	}
+
+	if (logRows >= MIN_COMPACT_ROWS && logRows > 2 * rows.size()) {
+		return compact();
+	}
+	return true;
+}
+
+bool MatchStore::append(const vector<string>& row) {
+	if (log == nullptr) {
+		log = fopen(logPath.c_str(), "ab+");
+		if (log == nullptr) {
+			cerr << "Error: Could not open " << logPath << endl;
+			return false;
+		}
+
+		// Start new logs with the header, and end a row torn by a crash so the next row
+		// doesn't run into it.
+		fseek(log, 0, SEEK_END);
+		if (ftell(log) == 0) {
+			auto header = formatCsvLine(columns);
+			fwrite(header.data(), 1, header.size(), log);
+		} else {
+			fseek(log, -1, SEEK_END);
+			bool torn = fgetc(log) != '\n';
+			fseek(log, 0, SEEK_END);
+			if (torn) {
+				fputc('\n', log);
+			}
+		}
+	}
+
+	auto line = formatCsvLine(row);
+	if (fwrite(line.data(), 1, line.size(), log) != line.size() || fflush(log) != 0) {
+		cerr << "Error: Could not write to " << logPath << endl;
+		return false;
+	}
+	logRows++;
+	return true;
+}
+
+bool MatchStore::importCsv(const string path) {
+	ifstream in(path, ios::binary);
+	if (!in) {
+		cerr << "Error: Could not open " << path << endl;
+		return false;
+	}
+	skipBOM(in);
+
+	// Map the file's columns onto ours by name.
+	vector<string> header;
+	if (!parseCsvLine(in, header)) {
+		return true;
+	}
+	if (columns.empty() && !setColumns(header)) {
+		return false;
+	}
+
+	vector<int> source(columns.size(), -1);
+	for (size_t i = 0; i < columns.size(); i++) {
+		auto found = std::find(header.begin(), header.end(), columns[i]);
+		if (found != header.end()) {
+			source[i] = static_cast<int>(found - header.begin());
+		}
+	}
+
+	vector<string> fields;
+	vector<string> row(columns.size());
+	PutResult result;
+	while (parseCsvLine(in, fields)) {
+		if (fields.size() == 1 && fields[0].empty()) {
+			continue;
+		}
+		for (size_t i = 0; i < columns.size(); i++) {
+			row[i] = source[i] >= 0 && static_cast<size_t>(source[i]) < fields.size()
+					? fields[source[i]] : "";
+		}
+		if (!put(row, true, result)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool writeCsvFile(const string path, const vector<string>& columns,
+		const vector<vector<string>>& rows, bool bom) {
+	string contents = bom ? "\xef\xbb\xbf" : "";
+	contents += formatCsvLine(columns);
+	for (auto&& row : rows) {
+		contents += formatCsvLine(row);
+	}
+	return replaceFile(path, contents);
+}
+
+bool MatchStore::exportCsv(const string path) const {
+	return writeCsvFile(path, columns, rows, true);
+}
+
+bool MatchStore::compact() {
+	if (log != nullptr) {
+		fclose(log);
+		log = nullptr;
+	}
+
+	if (!writeCsvFile(logPath, columns, rows, false)) {
+		return false;
+	}
+	logRows = rows.size();
+	return true;
+}
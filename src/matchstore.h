@@ -0,0 +1,70 @@
+#ifndef MATCHSTORE_H
+#define MATCHSTORE_H
+
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Scanned match records keyed by (competition, match, team).
+//
+// Records live in memory with a hash index on the key. Every put is appended to a log
+// file, a CSV file in which later rows replace earlier rows with the same key, so adding
+// or overwriting a record costs the same however large the season gets. The log is
+// compacted by rewriting it once superseded rows outnumber the live ones.
+class MatchStore {
+public:
+	enum class PutResult {
+		Added,
+		Duplicate,  // Already stored and not overwritten.
+		Overwritten
+	};
+
+	MatchStore() = default;
+	~MatchStore();
+
+	MatchStore(const MatchStore&) = delete;
+	MatchStore& operator=(const MatchStore&) = delete;
+
+	// Open or create the log. The columns must include competition, match and team,
+	// and must match the header of an existing log. If no columns are given they are
+	// taken from the existing log, or from the first imported CSV file.
+	bool open(const std::string logPath, const std::vector<std::string>& columns);
+
+	// Find the stored record with the same key as the row, or nullptr.
+	const std::vector<std::string>* find(const std::vector<std::string>& row) const;
+	bool put(const std::vector<std::string>& row, bool overwrite, PutResult& outResult);
+
+	// Put every row of a CSV file such as RoverRuckus.csv, overwriting earlier rows.
+	// Columns are matched by name.
+	bool importCsv(const std::string path);
+
+	// Write the live records as a CSV file that RoverRuckus.twb can read.
+	bool exportCsv(const std::string path) const;
+
+	// Rewrite the log with only the live records.
+	bool compact();
+
+	size_t size() const { return rows.size(); }
+	const std::vector<std::vector<std::string>>& records() const { return rows; }
+	const std::vector<std::string>& fieldNames() const { return columns; }
+
+	// Rows in the log. It grows with every added or overwritten record, so it tells
+	// whether records were stored since it was last looked at.
+	size_t logSize() const { return logRows; }
+
+private:
+	bool setColumns(const std::vector<std::string>& columns);
+	std::string keyOf(const std::vector<std::string>& row) const;
+	bool append(const std::vector<std::string>& row);
+
+	std::string logPath;
+	FILE* log = nullptr;
+	std::vector<std::string> columns;
+	size_t keyColumns[3] = { };
+	std::vector<std::vector<std::string>> rows;
+	std::unordered_map<std::string, size_t> index;
+	size_t logRows = 0;
+};
+
+#endif
@@ -0,0 +1,358 @@
+#include "output.h"
+
+#include <cmath>
+
+using namespace std;
+
+// Flush batches once they reach this size.
+const size_t BATCH_BYTES = 64 * 1024;
+
+// Binary fills and margins are scaled to 0..FILL_SCALE, keeping NO_FILL for fills that
+// couldn't be measured.
+const unsigned FILL_SCALE = 0xfffe;
+const unsigned NO_FILL = 0xffff;
+
+bool parseOutputFormat(const string& name, OutputFormat& outFormat) {
+	if (name == "ndjson") {
+		outFormat = OutputFormat::NDJSON;
+	} else if (name == "csv") {
+		outFormat = OutputFormat::CSV;
+	} else if (name == "binary") {
+		outFormat = OutputFormat::Binary;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool parseFlushPolicy(const string& name, FlushPolicy& outPolicy) {
+	if (name == "record") {
+		outPolicy = FlushPolicy::Record;
+	} else if (name == "batch") {
+		outPolicy = FlushPolicy::Batch;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+ResultWriter::ResultWriter(FILE* out, OutputFormat format, FlushPolicy policy) :
+	out { out }, format { format }, policy { policy }
+{
+	buffer.reserve(BATCH_BYTES * 2);
+	if (format == OutputFormat::Binary) {
+		appendText("PSR1");
+	}
+}
+
+ResultWriter::~ResultWriter() {
+	flush();
+}
+
+void ResultWriter::writeResult(const string& qrData, const vector<string>& ids,
+		const vector<float>& fills) {
+	if (!headerWritten) {
+		static const string qrColumn = "qr_data";
+		vector<const string*> names { &qrColumn };
+		for (auto&& id : ids) {
+			names.push_back(&id);
+		}
+		writeHeader(names);
+	}
+
+	switch (format) {
+	case OutputFormat::NDJSON:
+		appendText("{\"qr_data\":");
+		appendJsonString(qrData);
+		for (size_t i = 0; i < fills.size(); i++) {
+			buffer += ',';
+			appendJsonString(ids[i]);
+			buffer += ':';
+			appendFill(fills[i]);
+		}
+		appendText("}\n");
+		break;
+
+	case OutputFormat::CSV:
+		appendCsvField(qrData);
+		for (auto fill : fills) {
+			buffer += ',';
+			appendFill(fill);
+		}
+		buffer += '\n';
+		break;
+
+	case OutputFormat::Binary:
+		buffer += 'R';
+		appendBinaryString(qrData);
+		for (auto fill : fills) {
+			appendBinaryFill(fill);
+		}
+		break;
+	}
+
+	endRecord();
+}
+
+void ResultWriter::writeGroups(const string& qrData, const vector<BubbleGroup>& groups,
+		const vector<GroupDecision>& decisions) {
+	static const string empty;
+	static const string multi = "multi";
+
+	if (!headerWritten) {
+		vector<string> columns { "qr_data" };
+		for (auto&& group : groups) {
+			columns.push_back(group.Name);
+			columns.push_back(group.Name + "_margin");
+			columns.push_back(group.Name + "_flag");
+		}
+		vector<const string*> names;
+		for (auto&& column : columns) {
+			names.push_back(&column);
+		}
+		writeHeader(names);
+	}
+
+	switch (format) {
+	case OutputFormat::NDJSON:
+		appendText("{\"qr_data\":");
+		appendJsonString(qrData);
+		for (size_t i = 0; i < groups.size(); i++) {
+			auto& decision = decisions[i];
+			buffer += ',';
+			appendJsonString(groups[i].Name);
+			appendText(":{\"option\":");
+			appendJsonString(decision.Choice >= 0 ? groups[i].Options[decision.Choice] : empty);
+			appendText(",\"margin\":");
+			appendFill(decision.Margin);
+			if (decision.Multiple) {
+				appendText(",\"multi\":true");
+			}
+			buffer += '}';
+		}
+		appendText("}\n");
+		break;
+
+	case OutputFormat::CSV:
+		appendCsvField(qrData);
+		for (size_t i = 0; i < groups.size(); i++) {
+			auto& decision = decisions[i];
+			buffer += ',';
+			appendCsvField(decision.Choice >= 0 ? groups[i].Options[decision.Choice] : empty);
+			buffer += ',';
+			appendFill(decision.Margin);
+			buffer += ',';
+			appendText(decision.Multiple ? multi : empty);
+		}
+		buffer += '\n';
+		break;
+
+	case OutputFormat::Binary:
+		buffer += 'G';
+		appendBinaryString(qrData);
+		for (auto&& decision : decisions) {
+			appendU16(decision.Choice >= 0 ? static_cast<unsigned>(decision.Choice) : 0xffff);
+			appendU16(decision.Multiple ? 1 : 0);
+			appendBinaryFill(decision.Margin);
+		}
+		break;
+	}
+
+	endRecord();
+}
+
+static bool isNumber(const string& text) {
+	return !text.empty() && text.find_first_not_of("0123456789") == string::npos;
+}
+
+void ResultWriter::writeRecord(const FieldSchema& schema, const vector<DecodedField>& record,
+		const string* errors) {
+	static const string errorsColumn = "errors";
+
+	if (!headerWritten) {
+		vector<const string*> names;
+		for (auto&& field : schema.Fields) {
+			names.push_back(&field.Name);
+		}
+		if (errors != nullptr) {
+			names.push_back(&errorsColumn);
+		}
+		writeHeader(names);
+	}
+
+	switch (format) {
+	case OutputFormat::NDJSON:
+		buffer += '{';
+		for (size_t i = 0; i < record.size(); i++) {
+			if (i > 0) {
+				buffer += ',';
+			}
+			appendJsonString(schema.Fields[i].Name);
+			buffer += ':';
+			if (isNumber(record[i].Text)) {
+				appendText(record[i].Text);
+			} else {
+				appendJsonString(record[i].Text);
+			}
+		}
+		if (errors != nullptr) {
+			buffer += ',';
+			appendJsonString(errorsColumn);
+			buffer += ':';
+			appendJsonString(*errors);
+		}
+		appendText("}\n");
+		break;
+
+	case OutputFormat::CSV:
+		for (size_t i = 0; i < record.size(); i++) {
+			if (i > 0) {
+				buffer += ',';
+			}
+			appendCsvField(record[i].Text);
+		}
+		if (errors != nullptr) {
+			buffer += ',';
+			appendCsvField(*errors);
+		}
+		buffer += '\n';
+		break;
+
+	case OutputFormat::Binary:
+		buffer += 'D';
+		for (auto&& field : record) {
+			appendBinaryString(field.Text);
+		}
+		if (errors != nullptr) {
+			appendBinaryString(*errors);
+		}
+		break;
+	}
+
+	endRecord();
+}
+
+void ResultWriter::flush() {
+	if (!buffer.empty()) {
+		fwrite(buffer.data(), 1, buffer.size(), out);
+		buffer.clear();
+	}
+	fflush(out);
+}
+
+void ResultWriter::resume() {
+	buffer.clear();
+	headerWritten = true;
+}
+
+void ResultWriter::writeHeader(const vector<const string*>& names) {
+	headerWritten = true;
+
+	switch (format) {
+	case OutputFormat::NDJSON:
+		break;
+
+	case OutputFormat::CSV:
+		for (size_t i = 0; i < names.size(); i++) {
+			if (i > 0) {
+				buffer += ',';
+			}
+			appendCsvField(*names[i]);
+		}
+		buffer += '\n';
+		break;
+
+	case OutputFormat::Binary:
+		buffer += 'H';
+		appendU16(static_cast<unsigned>(names.size()));
+		for (auto name : names) {
+			appendBinaryString(*name);
+		}
+		break;
+	}
+}
+
+void ResultWriter::endRecord() {
+	if (policy == FlushPolicy::Record || buffer.size() >= BATCH_BYTES) {
+		flush();
+	}
+}
+
+void ResultWriter::appendText(const string& text) {
+	buffer.append(text);
+}
+
+void ResultWriter::appendJsonString(const string& text) {
+	static const char hex[] = "0123456789abcdef";
+
+	buffer += '"';
+	for (char c : text) {
+		switch (c) {
+		case '"': buffer += "\\\""; break;
+		case '\\': buffer += "\\\\"; break;
+		case '\n': buffer += "\\n"; break;
+		case '\r': buffer += "\\r"; break;
+		case '\t': buffer += "\\t"; break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20) {
+				buffer += "\\u00";
+				buffer += hex[(c >> 4) & 0xf];
+				buffer += hex[c & 0xf];
+			} else {
+				buffer += c;
+			}
+		}
+	}
+	buffer += '"';
+}
+
+void ResultWriter::appendCsvField(const string& text) {
+	if (text.find_first_of(",\"\r\n") == string::npos) {
+		buffer += text;
+		return;
+	}
+
+	buffer += '"';
+	for (char c : text) {
+		if (c == '"') {
+			buffer += '"';
+		}
+		buffer += c;
+	}
+	buffer += '"';
+}
+
+// Fills are written with the 9 significant digits that always read back as the same
+// float, without trailing zeros, e.g. 0, 0.5, 0.312744141. A fill that couldn't be
+// measured is null in JSON and empty in CSV.
+void ResultWriter::appendFill(float value) {
+	if (!isfinite(value)) {
+		if (format == OutputFormat::NDJSON) {
+			appendText("null");
+		}
+		return;
+	}
+
+	char text[32];
+	int length = snprintf(text, sizeof(text), "%.9g", value);
+	buffer.append(text, length);
+}
+
+void ResultWriter::appendBinaryFill(float value) {
+	if (!isfinite(value)) {
+		appendU16(NO_FILL);
+		return;
+	}
+	appendU16(static_cast<unsigned>(lround(min(max(value, 0.0f), 1.0f) * FILL_SCALE)));
+}
+
+void ResultWriter::appendU16(unsigned value) {
+	buffer += static_cast<char>(value & 0xff);
+	buffer += static_cast<char>((value >> 8) & 0xff);
+}
+
+void ResultWriter::appendBinaryString(const string& text) {
+	auto length = min(text.size(), static_cast<size_t>(0xffff));
+	appendU16(static_cast<unsigned>(length));
+	buffer.append(text, 0, length);
+}
@@ -0,0 +1,83 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "decode.h"
+
+enum class OutputFormat {
+	NDJSON, // One JSON object per line.
+	CSV,    // Header row followed by one row per sheet.
+	Binary  // Length-prefixed little-endian blocks, see below.
+};
+
+enum class FlushPolicy {
+	Record, // Flush after every record, for interactive consumers.
+	Batch   // Flush when the buffer fills up and on destruction.
+};
+
+bool parseOutputFormat(const std::string& name, OutputFormat& outFormat);
+bool parseFlushPolicy(const std::string& name, FlushPolicy& outPolicy);
+
+// Formats results into a reusable buffer and writes it out according to the flush policy.
+//
+// The binary format starts with the magic "PSR1" followed by blocks:
+//   'H' u16 count, count * (u16 length, bytes)   Column names, written before the first row.
+//   'R' u16 length, QR bytes, count * u16 fill   Raw fills scaled to 0..65534, or 0xffff
+//                                                for a fill that couldn't be measured.
+//   'D' count * (u16 length, bytes)              Decoded record fields.
+//   'G' u16 length, QR bytes, count * (u16 choice, u16 flags, u16 margin)
+//                                                Group decisions. The choice is 0xffff for
+//                                                a blank group, flag 1 marks several options
+//                                                and the margin is scaled like a fill.
+class ResultWriter {
+public:
+	ResultWriter(FILE* out, OutputFormat format, FlushPolicy policy);
+	~ResultWriter();
+
+	ResultWriter(const ResultWriter&) = delete;
+	ResultWriter& operator=(const ResultWriter&) = delete;
+
+	// Write the raw fill of every shape, named by the ids in the same order.
+	void writeResult(const std::string& qrData, const std::vector<std::string>& ids,
+			const std::vector<float>& fills);
+
+	// Write one decision per bubble group instead of every fill. Each group has the
+	// chosen option, empty if blank, its margin over the runner-up, and a "multi" flag
+	// if several options were marked.
+	void writeGroups(const std::string& qrData, const std::vector<BubbleGroup>& groups,
+			const std::vector<GroupDecision>& decisions);
+
+	// Write a record decoded with the field schema. If the record was validated,
+	// the validation errors are written as a final "errors" field.
+	void writeRecord(const FieldSchema& schema, const std::vector<DecodedField>& record,
+			const std::string* errors = nullptr);
+
+	void flush();
+
+	// Continue output that already has the binary magic and the header row, e.g. after
+	// a journaled run was restarted. Call before writing anything.
+	void resume();
+
+private:
+	void writeHeader(const std::vector<const std::string*>& names);
+	void endRecord();
+
+	void appendText(const std::string& text);
+	void appendJsonString(const std::string& text);
+	void appendCsvField(const std::string& text);
+	void appendFill(float value);
+	void appendU16(unsigned value);
+	void appendBinaryFill(float value);
+	void appendBinaryString(const std::string& text);
+
+	FILE* out;
+	OutputFormat format;
+	FlushPolicy policy;
+	std::string buffer;
+	bool headerWritten = false;
+};
+
+#endif
@@ -89,49 +89,60 @@ for line in sys.stdin:
     data = json.loads(line)
     print("Read match")
 
-    results = {
-        "competition" : data["qr_data"],
-        "match" : parseNumberOrDefault(data, ["match1", "match2", "match3"], ""),
-        "team" : parseNumberOrDefault(data, ["team1", "team2", "team3", "team4", "team5"], ""),
-        "matchtype" : parseOptionOrDefault(data, "matchtype", 'Qual'),
-        "color" : parseOptionOrDefault(data, "color", ''),
-        "startingside" : parseOptionOrDefault(data, "side", ''),
-        "landed" : parseOptionOrDefault(data, "landed", 0),
-        "sampled" : parseOptionOrDefault(data, "sampled", 0),
-        "claimed" : parseOptionOrDefault(data, "claimed", 0),
-        "parked" : parseOptionOrDefault(data, "parked", 0),
-        "lander" : parseNumberOrDefault(data, ["lander1", "lander2"], 0),
-        "depot" : parseNumberOrDefault(data, ["depot1", "depot2"], 0),
-        "hanging" : parseOptionOrDefault(data, "hanging", 0),
-        "partincrater" : parseOptionOrDefault(data, "partincrater", 0),
-        "fullyincrater" : parseOptionOrDefault(data, "fullyincrater", 0),
-        "defense" : parseOptionOrDefault(data, "defense", 0),
-        "minor" : parseOptionOrDefault(data, "minor", 0),
-        "major" : parseOptionOrDefault(data, "major", 0),
-        "goldhold" : parseOptionOrDefault(data, "goldhold", 0),
-        "silverhold" : parseOptionOrDefault(data, "silverhold", 0),
-        "disconnect" : parseOptionOrDefault(data, "disconnect", 0)
-    }
-
-    teamNumberError = ""
-    if not isTeamNumberValid(results["team"]):
-        teamNumberError = "Team number is invalid!\n"
-        print("Skipped match due to invalid team number.")
-
-    matchNumberError = ""
-    if not isMatchNumberValid(results["match"]):
-        matchNumberError = "Match number is invalid!\n"
-        print("Skipped match due to invalid match number.")
-
-    totalNumberOfMineralsError = ""
-    if not isTotalNumberOfMineralsValid(results):
-        totalNumberOfMineralsError = "Total number of minerals scored is invalid!\n"
-        print("Skipped match due to invalid total number of minerals.")
-    
-    endGamePositionError = ""
-    if not isEndGamePositionValid(results):
-        endGamePositionError = "End Game position is invalid!\n"
-        print("Skipped match due to invalid End Game position")
+    scannerErrors = None
+    if "team" in data:
+        # Already decoded (and validated) by scorescan --fields RoverRuckus.fields
+        scannerErrors = data.pop("errors", None)
+        results = data
+    else:
+        results = {
+            "competition" : data["qr_data"],
+            "match" : parseNumberOrDefault(data, ["match1", "match2", "match3"], ""),
+            "team" : parseNumberOrDefault(data, ["team1", "team2", "team3", "team4", "team5"], ""),
+            "matchtype" : parseOptionOrDefault(data, "matchtype", 'Qual'),
+            "color" : parseOptionOrDefault(data, "color", ''),
+            "startingside" : parseOptionOrDefault(data, "side", ''),
+            "landed" : parseOptionOrDefault(data, "landed", 0),
+            "sampled" : parseOptionOrDefault(data, "sampled", 0),
+            "claimed" : parseOptionOrDefault(data, "claimed", 0),
+            "parked" : parseOptionOrDefault(data, "parked", 0),
+            "lander" : parseNumberOrDefault(data, ["lander1", "lander2"], 0),
+            "depot" : parseNumberOrDefault(data, ["depot1", "depot2"], 0),
+            "hanging" : parseOptionOrDefault(data, "hanging", 0),
+            "partincrater" : parseOptionOrDefault(data, "partincrater", 0),
+            "fullyincrater" : parseOptionOrDefault(data, "fullyincrater", 0),
+            "defense" : parseOptionOrDefault(data, "defense", 0),
+            "minor" : parseOptionOrDefault(data, "minor", 0),
+            "major" : parseOptionOrDefault(data, "major", 0),
+            "goldhold" : parseOptionOrDefault(data, "goldhold", 0),
+            "silverhold" : parseOptionOrDefault(data, "silverhold", 0),
+            "disconnect" : parseOptionOrDefault(data, "disconnect", 0)
+        }
+
+    if scannerErrors is not None:
+        errorMessage = scannerErrors
+    else:
+        teamNumberError = ""
+        if not isTeamNumberValid(results["team"]):
+            teamNumberError = "Team number is invalid!\n"
+            print("Skipped match due to invalid team number.")
+
+        matchNumberError = ""
+        if not isMatchNumberValid(results["match"]):
+            matchNumberError = "Match number is invalid!\n"
+            print("Skipped match due to invalid match number.")
+
+        totalNumberOfMineralsError = ""
+        if not isTotalNumberOfMineralsValid(results):
+            totalNumberOfMineralsError = "Total number of minerals scored is invalid!\n"
+            print("Skipped match due to invalid total number of minerals.")
+
+        endGamePositionError = ""
+        if not isEndGamePositionValid(results):
+            endGamePositionError = "End Game position is invalid!\n"
+            print("Skipped match due to invalid End Game position")
+
+        errorMessage = teamNumberError + matchNumberError + endGamePositionError + totalNumberOfMineralsError
 
     if indexOfAlreadyScannedMatch(results) != -1: 
         duplicateMatchError = "Match has already been scanned!\n"
@@ -146,8 +157,6 @@ for line in sys.stdin:
             print("Overwrote match at index " + str(indexOfAlreadyScannedMatch(results)))
             continue
 
-    errorMessage = teamNumberError + matchNumberError + endGamePositionError + totalNumberOfMineralsError
-
     if errorMessage != "":
         root.lift()
         messagebox.showerror("Error", errorMessage)
@@ -0,0 +1,251 @@
+#include "qrcode.h"
+
+using namespace std;
+
+// Error correction codewords per block and number of blocks for medium error correction,
+// indexed by version. All blocks have the same length for versions 1 to 6.
+static const int ECC_PER_BLOCK[] = { 0, 10, 16, 26, 18, 24, 16 };
+static const int BLOCKS[] = { 0, 1, 1, 1, 2, 2, 4 };
+static const int MAX_VERSION = 6;
+
+// Format bits for the medium error correction level.
+static const int LEVEL_MEDIUM = 0;
+
+static int rawDataModules(int version) {
+	int modules = (16 * version + 128) * version + 64;
+	if (version >= 2) {
+		int alignments = version / 7 + 2;
+		modules -= (25 * alignments - 10) * alignments - 55;
+	}
+	return modules;
+}
+
+// Multiply in GF(2^8) modulo x^8 + x^4 + x^3 + x^2 + 1.
+static uint8_t multiply(uint8_t x, uint8_t y) {
+	int z = 0;
+	for (int i = 7; i >= 0; i--) {
+		z = (z << 1) ^ ((z >> 7) * 0x11d);
+		z ^= ((y >> i) & 1) * x;
+	}
+	return static_cast<uint8_t>(z);
+}
+
+vector<uint8_t> reedSolomonRemainder(const vector<uint8_t>& data, int degree) {
+	// Generator polynomial (x - 2^0)(x - 2^1)...(x - 2^(degree-1)), leading term omitted.
+	vector<uint8_t> divisor(degree);
+	divisor[degree - 1] = 1;
+	uint8_t root = 1;
+	for (int i = 0; i < degree; i++) {
+		for (int j = 0; j < degree; j++) {
+			divisor[j] = multiply(divisor[j], root);
+			if (j + 1 < degree) {
+				divisor[j] ^= divisor[j + 1];
+			}
+		}
+		root = multiply(root, 0x02);
+	}
+
+	vector<uint8_t> remainder(degree);
+	for (auto byte : data) {
+		uint8_t factor = byte ^ remainder[0];
+		remainder.erase(remainder.begin());
+		remainder.push_back(0);
+		for (int i = 0; i < degree; i++) {
+			remainder[i] ^= multiply(divisor[i], factor);
+		}
+	}
+	return remainder;
+}
+
+int qrFormatBits(int errorCorrectionLevel, int mask) {
+	int data = errorCorrectionLevel << 3 | mask;
+	int remainder = data;
+	for (int i = 0; i < 10; i++) {
+		remainder = (remainder << 1) ^ ((remainder >> 9) * 0x537);
+	}
+	return (data << 10 | remainder) ^ 0x5412;
+}
+
+namespace {
+
+class SymbolBuilder {
+public:
+	explicit SymbolBuilder(int version) :
+		size { version * 4 + 17 },
+		modules(size * size),
+		function(size * size)
+	{
+		// Timing patterns first, the finders overwrite their ends.
+		for (int i = 0; i < size; i++) {
+			setFunction(6, i, i % 2 == 0);
+			setFunction(i, 6, i % 2 == 0);
+		}
+
+		drawFinder(3, 3);
+		drawFinder(size - 4, 3);
+		drawFinder(3, size - 4);
+
+		// Versions 2 to 6 have a single alignment pattern; the others would overlap finders.
+		if (version >= 2) {
+			int position = size - 7;
+			for (int dy = -2; dy <= 2; dy++) {
+				for (int dx = -2; dx <= 2; dx++) {
+					setFunction(position + dx, position + dy, max(abs(dx), abs(dy)) != 1);
+				}
+			}
+		}
+
+		// Reserve the format areas, filled in by drawFormat.
+		drawFormat(0);
+	}
+
+	void drawCodewords(const vector<uint8_t>& codewords) {
+		size_t bit = 0;
+		for (int right = size - 1; right >= 1; right -= 2) {
+			if (right == 6) {
+				right = 5; // Skip the vertical timing pattern.
+			}
+			for (int vertical = 0; vertical < size; vertical++) {
+				for (int j = 0; j < 2; j++) {
+					int x = right - j;
+					bool upward = ((right + 1) & 2) == 0;
+					int y = upward ? size - 1 - vertical : vertical;
+					if (!function[y * size + x] && bit < codewords.size() * 8) {
+						modules[y * size + x] = (codewords[bit >> 3] >> (7 - (bit & 7))) & 1;
+						bit++;
+					}
+				}
+			}
+		}
+	}
+
+	// Mask 0 inverts modules where x + y is even. Any mask is valid, decoders read
+	// the mask from the format bits.
+	void applyMask() {
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				if (!function[y * size + x] && (x + y) % 2 == 0) {
+					modules[y * size + x] ^= 1;
+				}
+			}
+		}
+		drawFormat(qrFormatBits(LEVEL_MEDIUM, 0));
+	}
+
+	QRCode symbol() const {
+		return QRCode { size, modules };
+	}
+
+private:
+	void setFunction(int x, int y, bool dark) {
+		modules[y * size + x] = dark ? 1 : 0;
+		function[y * size + x] = 1;
+	}
+
+	// Finder pattern centered at (x, y), including its light separator.
+	void drawFinder(int x, int y) {
+		for (int dy = -4; dy <= 4; dy++) {
+			for (int dx = -4; dx <= 4; dx++) {
+				int distance = max(abs(dx), abs(dy));
+				int xx = x + dx, yy = y + dy;
+				if (xx >= 0 && xx < size && yy >= 0 && yy < size) {
+					setFunction(xx, yy, distance != 2 && distance != 4);
+				}
+			}
+		}
+	}
+
+	void drawFormat(int bits) {
+		auto bit = [bits](int i) { return ((bits >> i) & 1) != 0; };
+
+		for (int i = 0; i <= 5; i++) {
+			setFunction(8, i, bit(i));
+		}
+		setFunction(8, 7, bit(6));
+		setFunction(8, 8, bit(7));
+		setFunction(7, 8, bit(8));
+		for (int i = 9; i < 15; i++) {
+			setFunction(14 - i, 8, bit(i));
+		}
+
+		for (int i = 0; i < 8; i++) {
+			setFunction(size - 1 - i, 8, bit(i));
+		}
+		for (int i = 8; i < 15; i++) {
+			setFunction(8, size - 15 + i, bit(i));
+		}
+		setFunction(8, size - 8, true); // Always dark.
+	}
+
+	int size;
+	vector<uint8_t> modules;
+	vector<uint8_t> function;
+};
+
+}
+
+QRCode encodeQRCode(const string& text) {
+	int version = 1;
+	int dataCodewords = 0;
+	for (; version <= MAX_VERSION; version++) {
+		dataCodewords = rawDataModules(version) / 8 - ECC_PER_BLOCK[version] * BLOCKS[version];
+		if (text.size() + 2 <= static_cast<size_t>(dataCodewords)) {
+			break;
+		}
+	}
+	if (version > MAX_VERSION) {
+		return { };
+	}
+
+	// Byte mode indicator, 8 bit length, the data, then a terminator and padding.
+	vector<uint8_t> data;
+	uint32_t accumulator = 0;
+	int bits = 0;
+	auto append = [&](uint32_t value, int length) {
+		accumulator = accumulator << length | value;
+		bits += length;
+		while (bits >= 8) {
+			bits -= 8;
+			data.push_back(static_cast<uint8_t>(accumulator >> bits));
+		}
+	};
+
+	append(0x4, 4);
+	append(static_cast<uint32_t>(text.size()), 8);
+	for (unsigned char c : text) {
+		append(c, 8);
+	}
+	append(0, min(4, dataCodewords * 8 - static_cast<int>(data.size()) * 8 - bits));
+	if (bits > 0) {
+		append(0, 8 - bits);
+	}
+	for (uint8_t pad = 0xec; static_cast<int>(data.size()) < dataCodewords; pad ^= 0xec ^ 0x11) {
+		data.push_back(pad);
+	}
+
+	// Split into blocks, add error correction, and interleave.
+	int blocks = BLOCKS[version];
+	int blockLength = dataCodewords / blocks;
+	vector<vector<uint8_t>> eccBlocks;
+	for (int b = 0; b < blocks; b++) {
+		vector<uint8_t> block(data.begin() + b * blockLength, data.begin() + (b + 1) * blockLength);
+		eccBlocks.push_back(reedSolomonRemainder(block, ECC_PER_BLOCK[version]));
+	}
+
+	vector<uint8_t> codewords;
+	for (int i = 0; i < blockLength; i++) {
+		for (int b = 0; b < blocks; b++) {
+			codewords.push_back(data[b * blockLength + i]);
+		}
+	}
+	for (int i = 0; i < ECC_PER_BLOCK[version]; i++) {
+		for (int b = 0; b < blocks; b++) {
+			codewords.push_back(eccBlocks[b][i]);
+		}
+	}
+
+	SymbolBuilder builder(version);
+	builder.drawCodewords(codewords);
+	builder.applyMask();
+	return builder.symbol();
+}
@@ -0,0 +1,25 @@
+#ifndef QRCODE_H
+#define QRCODE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A QR code symbol, without the quiet zone.
+struct QRCode {
+	int Size = 0;
+	std::vector<uint8_t> Modules; // Row major, 1 for dark modules.
+
+	bool dark(int x, int y) const { return Modules[y * Size + x] != 0; }
+};
+
+// Encode text in byte mode with medium error correction, using the smallest of
+// versions 1 to 6 that fits. That holds up to 106 bytes, plenty for the competition
+// names we print on sheets. Returns an empty symbol if the text is too long.
+QRCode encodeQRCode(const std::string& text);
+
+// Exposed for checking against published examples.
+std::vector<uint8_t> reedSolomonRemainder(const std::vector<uint8_t>& data, int degree);
+int qrFormatBits(int errorCorrectionLevel, int mask);
+
+#endif
@@ -0,0 +1,235 @@
+#include "resultcache.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "csv.h"
+#include "ingest.h"
+
+using namespace std;
+
+// Bump when the meaning of cached results changes, so old entries are ignored.
+const uint64_t CACHE_VERSION = 2;
+
+const uint64_t HASH_MULTIPLIER = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t mixHash(uint64_t value) {
+	value ^= value >> 33;
+	value *= 0xff51afd7ed558ccdULL;
+	value ^= value >> 33;
+	value *= 0xc4ceb9fe1a85ec53ULL;
+	value ^= value >> 33;
+	return value;
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed) {
+	auto bytes = static_cast<const unsigned char*>(data);
+	uint64_t hash = seed ^ (size * HASH_MULTIPLIER);
+
+	// Four independent lanes keep the multiplies from waiting on each other.
+	uint64_t lanes[4] = { hash, hash + 1, hash + 2, hash + 3 };
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32) {
+		for (int lane = 0; lane < 4; lane++) {
+			uint64_t word;
+			memcpy(&word, bytes + i + lane * 8, 8);
+			lanes[lane] = (lanes[lane] ^ word) * HASH_MULTIPLIER;
+			lanes[lane] ^= lanes[lane] >> 29;
+		}
+	}
+	for (int lane = 0; lane < 4; lane++) {
+		hash = (hash ^ mixHash(lanes[lane])) * HASH_MULTIPLIER;
+	}
+
+	for (; i < size; i++) {
+		hash = (hash ^ bytes[i]) * HASH_MULTIPLIER;
+	}
+	return mixHash(hash);
+}
+
+uint64_t scanKey(const string& svgFile, const ScanSettings& settings) {
+	vector<unsigned char> svg;
+	readFileBytes(svgFile, svg);
+	uint64_t key = hashBytes(svg.data(), svg.size(), CACHE_VERSION);
+
+	uint64_t parameters[] = {
+		static_cast<uint64_t>(settings.thresholdSampling),
+		static_cast<uint64_t>(settings.lighting),
+		static_cast<uint64_t>(settings.tieredSampling),
+		static_cast<uint64_t>(settings.detectScale),
+		static_cast<uint64_t>(settings.layoutShapes)
+	};
+	return hashBytes(parameters, sizeof(parameters), key);
+}
+
+bool readFileBytes(const string& path, vector<unsigned char>& outBytes) {
+	ifstream in(path, ios::binary | ios::ate);
+	if (!in) {
+		outBytes.clear();
+		return false;
+	}
+	outBytes.resize(static_cast<size_t>(in.tellg()));
+	in.seekg(0);
+	return static_cast<bool>(in.read(reinterpret_cast<char*>(outBytes.data()), outBytes.size()));
+}
+
+static string formatHash(uint64_t hash) {
+	char text[17];
+	snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(hash));
+	return text;
+}
+
+// Checksum of the fields of a row before the checksum column.
+static string rowChecksum(const vector<string>& row, size_t fields) {
+	uint64_t hash = 0;
+	for (size_t i = 0; i < fields; i++) {
+		hash = hashBytes(row[i].data(), row[i].size(), hash);
+	}
+	return formatHash(hash);
+}
+
+ResultCache::~ResultCache() {
+	if (log != nullptr) {
+		fclose(log);
+	}
+}
+
+bool ResultCache::open(const string& logPath, uint64_t scanKey) {
+	this->logPath = logPath;
+	key = scanKey;
+	entries.clear();
+
+	string keyText = formatHash(scanKey);
+	ifstream in(logPath, ios::binary);
+	vector<string> row;
+	bool endsLine = true;
+	for (streampos start = in.tellg(); in && parseCsvLine(in, row); start = in.tellg()) {
+		// A row cut short by a crash is skipped, the image is simply scanned again. Rows
+		// a torn quoted field ran into are read again from the line after it.
+		if (row.size() < 4 || row[0] != keyText
+				|| row.back() != rowChecksum(row, row.size() - 1)) {
+			skipCsvLine(in, start);
+			continue;
+		}
+		row.pop_back();
+		size_t forms = strtoul(row[2].c_str(), nullptr, 10);
+		size_t fills = row.size() >= 3 + 2 * forms ? row.size() - 3 - 2 * forms : 0;
+		if (row.size() < 3 + 2 * forms || (forms > 0 ? fills % forms != 0 : fills != 0)) {
+			skipCsvLine(in, start);
+			continue;
+		}
+
+		auto& entry = entries[strtoull(row[1].c_str(), nullptr, 16)];
+		entry.resize(forms);
+		size_t column = 3 + 2 * forms;
+		for (size_t form = 0; form < forms; form++) {
+			entry[form].QRData = row[3 + form];
+			entry[form].Threshold = atoi(row[3 + forms + form].c_str());
+			entry[form].Fills.resize(fills / forms);
+			for (auto& fill : entry[form].Fills) {
+				fill = strtof(row[column++].c_str(), nullptr);
+			}
+		}
+	}
+
+	// Make sure the next row doesn't continue a row cut short by a crash.
+	in.clear();
+	if (in.seekg(-1, ios::end)) {
+		endsLine = in.get() == '\n';
+	}
+
+	log = fopen(logPath.c_str(), "ab");
+	if (log == nullptr) {
+		cerr << "Error: Could not open " << logPath << endl;
+		return false;
+	}
+	if (!endsLine) {
+		fputc('\n', log);
+	}
+	return true;
+}
+
+bool ResultCache::find(uint64_t imageHash, vector<ScanResult>& outResults) const {
+	lock_guard<std::mutex> lock(mutex);
+	auto found = entries.find(imageHash);
+	if (found == entries.end()) {
+		return false;
+	}
+
+	outResults.resize(found->second.size());
+	for (size_t form = 0; form < outResults.size(); form++) {
+		auto& cached = found->second[form];
+		auto& result = outResults[form];
+		result.qrData = cached.QRData;
+		result.fills = cached.Fills;
+		result.threshold = cached.Threshold;
+		result.fullThreshold = -1;
+		result.escalated = 0;
+		result.preview.release();
+		result.decisions.clear();
+	}
+	return true;
+}
+
+bool ResultCache::put(uint64_t imageHash, const vector<ScanResult>& results) {
+	if (results.empty()) {
+		return true;
+	}
+
+	vector<Form> entry(results.size());
+	vector<string> row { formatHash(key), formatHash(imageHash), to_string(results.size()) };
+	for (size_t form = 0; form < results.size(); form++) {
+		entry[form] = Form { results[form].qrData, results[form].threshold, results[form].fills };
+		row.push_back(results[form].qrData);
+	}
+	for (auto&& result : results) {
+		row.push_back(to_string(result.threshold));
+	}
+	for (auto&& result : results) {
+		for (auto fill : result.fills) {
+			char text[32];
+			snprintf(text, sizeof(text), "%.9g", fill); // Enough digits to read back exactly.
+			row.push_back(text);
+		}
+	}
+	row.push_back(rowChecksum(row, row.size()));
+
+	lock_guard<std::mutex> lock(mutex);
+	auto line = formatCsvLine(row);
+	if (fwrite(line.data(), 1, line.size(), log) != line.size() || fflush(log) != 0) {
+		cerr << "Error: Could not write to " << logPath << endl;
+		return false;
+	}
+	entries[imageHash] = move(entry);
+	return true;
+}
+
+size_t ResultCache::size() const {
+	lock_guard<std::mutex> lock(mutex);
+	return entries.size();
+}
+
+vector<ScanResult>* scanEncoded(ScanContext& context, ResultCache* cache,
+		const vector<unsigned char>& bytes, cv::Size pageSize, cv::Rect2f qrBox,
+		const map<string, SVGShape>& shapes, vector<ScanResult>& cachedResults) {
+	uint64_t imageHash = 0;
+	if (cache != nullptr) {
+		imageHash = hashBytes(bytes.data(), bytes.size());
+		if (cache->find(imageHash, cachedResults)) {
+			if (context.groups != nullptr) {
+				for (auto& result : cachedResults) {
+					decideGroups(*context.groups, result.fills, result.decisions);
+				}
+			}
+			return &cachedResults;
+		}
+	}
+
+	auto results = scanImageBytes(context, bytes, pageSize, qrBox, shapes);
+	if (results != nullptr && cache != nullptr) {
+		cache->put(imageHash, *results);
+	}
+	return results;
+}
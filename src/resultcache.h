@@ -0,0 +1,73 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "scanner.h"
+
+// A fast 64-bit hash of a block of memory, read eight bytes at a time.
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+// Hash of everything besides the image that affects scan results: the template and
+// the scan settings.
+uint64_t scanKey(const std::string& svgFile, const ScanSettings& settings);
+
+// Read a whole file, e.g. an encoded image to hash before decoding it.
+bool readFileBytes(const std::string& path, std::vector<unsigned char>& outBytes);
+
+// Scan results by the hash of the encoded image they came from, so images that are fed
+// again are answered without decoding, QR scanning or registration.
+//
+// Entries live in memory and are appended to a log file, a CSV file with one row per
+// image: scan key, image hash, form count, the QR data and threshold of each form, the
+// fills of every form and last a checksum of the row, so rows cut short by a crash are
+// ignored. Rows of other scan keys are kept but not loaded, so one file can serve several
+// templates. Images without forms aren't cached, they may have been too blurry to find
+// the QR code in. Cached results have no preview. Safe to use from several threads, but
+// only one process should use a file at a time.
+class ResultCache {
+public:
+	ResultCache() = default;
+	~ResultCache();
+
+	ResultCache(const ResultCache&) = delete;
+	ResultCache& operator=(const ResultCache&) = delete;
+
+	// Open or create the log and load the entries scanned with the given key.
+	bool open(const std::string& logPath, uint64_t scanKey);
+
+	// The results stored for an image, or false if it hasn't been scanned.
+	bool find(uint64_t imageHash, std::vector<ScanResult>& outResults) const;
+	bool put(uint64_t imageHash, const std::vector<ScanResult>& results);
+
+	size_t size() const;
+
+private:
+	struct Form {
+		std::string QRData;
+		int Threshold;
+		std::vector<float> Fills;
+	};
+
+	std::string logPath;
+	FILE* log = nullptr;
+	uint64_t key = 0;
+	std::unordered_map<uint64_t, std::vector<Form>> entries;
+	mutable std::mutex mutex;
+};
+
+// Scan an encoded image, or answer it from the cache if one is given and has the image.
+// Cached results go to cachedResults, with group decisions if the context has groups,
+// fresh ones are added to the cache. Returns nullptr if the image can't be decoded.
+std::vector<ScanResult>* scanEncoded(ScanContext& context, ResultCache* cache,
+		const std::vector<unsigned char>& bytes, cv::Size pageSize, cv::Rect2f qrBox,
+		const std::map<std::string, SVGShape>& shapes, std::vector<ScanResult>& cachedResults);
+
+#endif
@@ -1,2 +1,2 @@
 #!/bin/bash
-../Release/scorescan sheetRR2.svg 1 | ./parseRoverRuckus.py >> $1
+../Release/scorescan --fields RoverRuckus.fields sheetRR2.svg 1 | ./parseRoverRuckus.py >> $1
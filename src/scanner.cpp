@@ -0,0 +1,484 @@
+#include "scanner.h"
+
+#include <algorithm>
+
+#include <opencv2/imgproc.hpp>
+
+#include "decode.h"
+#include "timing.h"
+
+using namespace std;
+using namespace zbar;
+
+void sortPointsCW(vector<cv::Point>& points) {
+	std::sort(points.begin(), points.end(),
+			[](cv::Point pt1, cv::Point pt2) {return (pt1.y < pt2.y);});
+	std::sort(points.begin(), points.begin() + 2,
+			[](cv::Point pt1, cv::Point pt2) {return (pt1.x < pt2.x);});
+	std::sort(points.begin() + 2, points.end(),
+			[](cv::Point pt1, cv::Point pt2) {return (pt1.x > pt2.x);});
+}
+
+vector<cv::Point2f> rectCorners(cv::Rect2f rect) {
+	return {
+		rect.tl(),
+		{rect.x + rect.width, rect.y},
+		rect.br(),
+		{rect.x, rect.y + rect.height}
+	};
+}
+
+void rectCorners(cv::Rect2f rect, cv::Point2f outCorners[4]) {
+	outCorners[0] = rect.tl();
+	outCorners[1] = { rect.x + rect.width, rect.y };
+	outCorners[2] = rect.br();
+	outCorners[3] = { rect.x, rect.y + rect.height };
+}
+
+ScanContext::ScanContext() {
+	configureScanner(scanner);
+	image.set_format("Y800");
+}
+
+size_t ScanContext::arenaCapacity() const {
+	size_t capacity = 0;
+	for (auto& form : forms) {
+		capacity += form->arena.capacity();
+	}
+	return capacity;
+}
+
+bool tryFindPage(FormScratch& scratch, const cv::Mat& inPage, cv::Mat& outPage,
+		const cv::Point2f srcQRCorners[4], cv::Size pageSize, cv::Rect2f qrBox) {
+	StageTimer warpTimer(Stage::PageWarp);
+
+	// Estimate the transformation using the location from the QR code
+	cv::Point2f qrCorners[4];
+	rectCorners(qrBox, qrCorners);
+	cv::Matx33d perspectiveTransform = cv::getPerspectiveTransform(srcQRCorners, qrCorners);
+
+	// Zoom out to include a larger area around the page to ensure we've got the whole page.
+	double scaleFactor = 0.7;
+	cv::Matx33d scale(
+			scaleFactor, 0, (1 - scaleFactor) * pageSize.width / 2.0,
+			0, scaleFactor, (1 - scaleFactor) * pageSize.height / 2.0,
+			0, 0, 1);
+	cv::Matx33d scalePerspective = scale * perspectiveTransform;
+	cv::Mat warped = scratch.arena.mat(pageSize, inPage.type());
+	cv::warpPerspective(inPage, warped, scalePerspective, pageSize);
+	warpTimer.stop();
+
+	StageTimer edgesTimer(Stage::PageEdges);
+
+	// Blur to remove noise.
+	cv::Mat blurred = scratch.arena.mat(pageSize, inPage.type());
+	cv::GaussianBlur(warped, blurred, { }, 1, 1);
+
+	// Find edges
+	cv::Mat edged = scratch.arena.mat(pageSize, CV_8UC1);
+	cv::Canny(blurred, edged, 75, 200);
+	edgesTimer.stop();
+
+	StageTimer contoursTimer(Stage::PageContours);
+
+	// Find contours.
+	auto& contours = scratch.contours;
+	cv::findContours(edged, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_NONE);
+
+	// Sort contours by area
+	auto& order = scratch.contourOrder;
+	order.clear();
+	for (size_t i = 0; i < contours.size(); i++) {
+		order.push_back({ cv::contourArea(contours[i]), i });
+	}
+	std::sort(order.begin(), order.end(),
+		[](const pair<double, size_t>& a, const pair<double, size_t>& b)
+		{ return a.first > b.first; });
+
+	for (auto& entry : order) {
+		auto& contour = contours[entry.second];
+
+		// Convert contours to polygon vertices.
+		auto& corners = scratch.corners;
+		cv::approxPolyDP(contour, corners, 0.05 * cv::arcLength(contour, true),
+				true);
+
+		// Look for 4-cornered shapes
+		if (corners.size() == 4) {
+			// Check that the area is large enough to likely be our box.
+			double area = entry.first / scaleFactor;
+			if (area / pageSize.area() < 0.5) {
+				break; // Area square too small.
+			}
+
+			// Order the points.
+			sortPointsCW(corners);
+
+			// Convert from Point to Point2f
+			cv::Point2f corners2f[4];
+			for (int i = 0; i < 4; i++) {
+				corners2f[i] = corners[i];
+			}
+
+			cv::Point2f pageCorners[4];
+			rectCorners(cv::Rect2f { { }, pageSize }, pageCorners);
+
+			contoursTimer.stop();
+			StageTimer finalWarpTimer(Stage::PageFinalWarp);
+
+			// Compute the transform to the corners of the rectangle
+			cv::Matx33d finalPerspective = cv::getPerspectiveTransform(corners2f, pageCorners);
+			outPage = scratch.arena.mat(pageSize, inPage.type());
+			cv::warpPerspective(inPage, outPage, finalPerspective * scalePerspective, pageSize);
+			return true;
+		}
+	}
+
+	// Failed to find corners.
+	return false;
+}
+
+// The page border strips come first in ScanContext::regions.
+const size_t BORDER_REGIONS = 4;
+
+// Blur only the regions of the page that are read. Filtering a ROI reads its halo
+// from the rest of the page, so every region comes out exactly as if the whole page
+// had been blurred. When the whole page was blurred anyway the regions are views of it.
+static void blurRegions(FormScratch& scratch, const cv::Mat& warped, const cv::Mat& blurredPage) {
+	auto& blurred = scratch.blurredRegions;
+	blurred.resize(scratch.regions.size());
+	for (size_t i = 0; i < blurred.size(); i++) {
+		auto& region = scratch.regions[i];
+		if (!blurredPage.empty()) {
+			blurred[i] = blurredPage(region);
+			continue;
+		}
+		blurred[i] = scratch.arena.mat(region.size(), CV_8UC1);
+		cv::GaussianBlur(warped(region), blurred[i], { }, 3, 3);
+	}
+}
+
+// Probe fills that decide a bubble without sampling all of it.
+const double PROBE_EMPTY = 0.05;
+const double PROBE_FILLED = 0.7;
+
+// Number of rows of a bubble that are probed. They're spread over its height, so a
+// single pen stroke across the bubble can't decide it.
+const size_t PROBE_SPANS = 3;
+
+// Fraction of the probe rows of a bubble at or below level on the blurred page, the
+// pixels a full sample reads too. Rows come from the blurred page if there is one and
+// are blurred one at a time otherwise. They're packed into the thresholded page, so the
+// preview shows what decided the bubble.
+static double probeFill(FormScratch& scratch, const cv::Mat& warped, const cv::Mat& blurredPage,
+		const vector<PixelSpan>& spans, int level, BitPage& thresholded) {
+	cv::Rect page(0, 0, warped.cols, warped.rows);
+	long dark = 0, area = 0;
+	for (size_t i = 1; i <= PROBE_SPANS && !spans.empty(); i++) {
+		auto& span = spans[i * spans.size() / (PROBE_SPANS + 1)];
+		cv::Rect row = cv::Rect(span.X0, span.Y, span.X1 - span.X0, 1) & page;
+		if (row.area() == 0) {
+			continue;
+		}
+
+		cv::Mat blurred;
+		if (blurredPage.empty()) {
+			blurred = scratch.arena.mat(row.size(), CV_8UC1);
+			cv::GaussianBlur(warped(row), blurred, { }, 3, 3);
+		} else {
+			blurred = blurredPage(row);
+		}
+		packThreshold(blurred, row.tl(), level, thresholded);
+
+		const uchar* pixels = blurred.ptr<uchar>(0);
+		for (int x = 0; x < row.width; x++) {
+			dark += pixels[x] <= level ? 1 : 0;
+		}
+		area += row.width;
+	}
+	return area > 0 ? static_cast<double>(dark) / area : 0;
+}
+
+// The whole page blurred, for Otsu's level of all of it.
+static cv::Mat blurPage(FormScratch& scratch, const cv::Mat& warped) {
+	cv::Mat blurred = scratch.arena.mat(warped.size(), CV_8UC1);
+	cv::GaussianBlur(warped, blurred, { }, 3, 3);
+	return blurred;
+}
+
+static int selectThreshold(const ScanSettings& settings, FormScratch& scratch, const cv::Mat& warped,
+		const cv::Mat& blurredPage) {
+	switch (settings.thresholdSampling) {
+	case ThresholdSampling::Full:
+		return otsuThreshold(blurredPage);
+
+	case ThresholdSampling::Reduced: {
+		cv::Mat reduced = scratch.arena.mat(warped.rows / 4, warped.cols / 4, CV_8UC1);
+		cv::resize(warped, reduced, reduced.size(), 0, 0, cv::INTER_AREA);
+		cv::GaussianBlur(reduced, reduced, { }, 0.75, 0.75);
+		return otsuThreshold(reduced);
+	}
+
+	case ThresholdSampling::Bubbles: {
+		Histogram histogram;
+		for (size_t i = BORDER_REGIONS; i < scratch.blurredRegions.size(); i++) {
+			accumulateHistogram(scratch.blurredRegions[i], histogram);
+		}
+		return otsuThreshold(histogram);
+	}
+	}
+	return 0;
+}
+
+// Register and sample one form. Only reads the context, so the forms of an image can
+// be scanned in parallel as long as each has its own scratch space and result.
+static bool scanForm(const ScanContext& context, FormScratch& scratch, const FormCode& code,
+		ScanResult& result, const cv::Mat& rawImage, float scale, const cv::Size pageSize,
+		const cv::Rect2f qrBox, const map<string, SVGShape>& shapes) {
+	StageTimer sheetTimer(Stage::Sheet);
+
+	// Temporaries of the previous sheet are no longer needed.
+	scratch.arena.reset();
+
+	cv::Point2f corners[4];
+	for (int i = 0; i < 4; i++) {
+		corners[i] = code.Corners[i] * (1 / scale);
+	}
+
+	cv::Mat warped;
+	if (!tryFindPage(scratch, rawImage, warped, corners, pageSize, qrBox)) {
+		return false;
+	}
+
+	cv::Mat preview = scratch.arena.mat(pageSize, CV_8UC3);
+	cv::cvtColor(warped, preview, cv::COLOR_GRAY2BGR);
+
+	// Only the page border and the shapes are ever read, so only they
+	// are blurred and thresholded.
+	auto& thresholded = scratch.thresholded;
+	cv::Rect page { { }, pageSize };
+	cv::Rect inner(5, 5, page.width - 9, page.height - 9);
+	auto& probes = scratch.probes;
+	int level = 0;
+	int escalated = 0;
+	cv::Mat blurredPage;
+	{
+		StageTimer timer(Stage::Threshold);
+		auto& regions = scratch.regions;
+		regions.clear();
+		regions.push_back({ 0, 0, page.width, inner.y });
+		regions.push_back({ 0, inner.br().y, page.width, page.height - inner.br().y });
+		regions.push_back({ 0, inner.y, inner.x, inner.height });
+		regions.push_back({ inner.br().x, inner.y, page.width - inner.br().x, inner.height });
+
+		// Under uneven lighting each bubble gets a level of its own, from the paper
+		// around it.
+		PaperIntegrals paper;
+		if (context.settings.lighting == Lighting::Uneven) {
+			cv::Mat mask = scratch.arena.mat(pageSize, CV_8UC1);
+			mask.setTo(1);
+			for (auto&& shape : shapes) {
+				if (isBubbleId(shape.first)) {
+					mask(shape.second.PixelBounds & page).setTo(0);
+				}
+			}
+			cv::Mat paperPixels = scratch.arena.mat(pageSize, CV_8UC1);
+			paperPixels.setTo(0);
+			warped.copyTo(paperPixels, mask);
+
+			paper.Sum = scratch.arena.mat(page.height + 1, page.width + 1, CV_32SC1);
+			paper.Area = scratch.arena.mat(page.height + 1, page.width + 1, CV_32SC1);
+			cv::integral(paperPixels, paper.Sum, CV_32S);
+			cv::integral(mask, paper.Area, CV_32S);
+		}
+		auto bubbleLevel = [&](cv::Rect region) {
+			return paper.Sum.empty() ? level : localThreshold(paper, region, level);
+		};
+
+		// The probe needs the level up front, which only sampling the bubbles can't give.
+		// The Full level blurs the whole page, and with that every bubble is as cheap to
+		// sample as to probe, so only Reduced sampling probes.
+		bool tiered = context.settings.tieredSampling
+				&& context.settings.thresholdSampling == ThresholdSampling::Reduced;
+		if (context.settings.thresholdSampling == ThresholdSampling::Full || context.checkThreshold) {
+			blurredPage = blurPage(scratch, warped);
+		}
+		if (tiered) {
+			level = selectThreshold(context.settings, scratch, warped, blurredPage);
+		}
+
+		clearBits(pageSize, thresholded);
+		probes.clear();
+		for (auto&& shape : shapes) {
+			cv::Rect region = shape.second.PixelBounds & page;
+			float probe = -1;
+			if (tiered) {
+				double fill = probeFill(scratch, warped, blurredPage, shape.second.Spans,
+						bubbleLevel(region), thresholded);
+				if (fill < PROBE_EMPTY || fill > PROBE_FILLED) {
+					probe = static_cast<float>(fill);
+				} else {
+					escalated++;
+				}
+			}
+			probes.push_back(probe);
+			if (probe < 0 && region.area() > 0) {
+				regions.push_back(region);
+			}
+		}
+
+		blurRegions(scratch, warped, blurredPage);
+		if (!tiered) {
+			level = selectThreshold(context.settings, scratch, warped, blurredPage);
+		}
+
+		for (size_t i = 0; i < regions.size(); i++) {
+			int regionLevel = i < BORDER_REGIONS ? level : bubbleLevel(regions[i]);
+			packThreshold(scratch.blurredRegions[i], regions[i].tl(), regionLevel, thresholded);
+		}
+	}
+
+	{
+		// Fraction of the 5 pixel border that is dark.
+		double border = static_cast<double>(countBits(thresholded, page) - countBits(thresholded, inner));
+		double mean = border / (page.area() - inner.area());
+		if (mean < 0.75) {
+			return false;
+		}
+	}
+
+	cv::Mat unpacked = scratch.arena.mat(pageSize, CV_8UC1);
+	unpackBits(thresholded, unpacked);
+	cv::Mat threshColor = scratch.arena.mat(pageSize, CV_8UC3);
+	cv::cvtColor(unpacked, threshColor, cv::COLOR_GRAY2BGR);
+
+	result.qrData = code.Data;
+	result.threshold = level;
+	result.fullThreshold = context.checkThreshold ? otsuThreshold(blurredPage) : -1;
+	result.escalated = escalated;
+
+	StageTimer samplingTimer(Stage::Sampling);
+	auto& shapeVector = scratch.outline;
+	shapeVector.resize(1);
+	result.fills.resize(probes.size());
+	size_t ordinal = 0;
+
+	for (auto&& shape : shapes) {
+		shapeVector[0] = shape.second.Outline;
+		float probe = probes[ordinal];
+		double filled = probe >= 0 ? probe : spanFill(thresholded, shape.second.Spans);
+
+		{
+			double green = (filled > FILL_THRESHOLD ? 1 : 0) * 255;
+			double red = 255 - green;
+			cv::drawContours(preview, shapeVector, -1, { 0, green, red }, 1);
+		}
+		{
+			double green = (filled) * 255;
+			double red = 255 - green;
+			cv::drawContours(threshColor, shapeVector, -1, { 0, green, red }, 2);
+		}
+		result.fills[ordinal++] = static_cast<float>(filled);
+	}
+
+	if (context.groups != nullptr) {
+		decideGroups(*context.groups, result.fills, result.decisions);
+	}
+	samplingTimer.stop();
+
+	cv::hconcat(preview, threshColor, result.preview);
+	return true;
+}
+
+vector<ScanResult>& scanImage(ScanContext& context, const cv::Mat& rawImage,
+		const cv::Size pageSize, const cv::Rect2f qrBox,
+		const map<string, SVGShape>& shapes) {
+	findCodes(context, rawImage, 1);
+	return scanForms(context, rawImage, 1, pageSize, qrBox, shapes);
+}
+
+size_t findCodes(ScanContext& context, const cv::Mat& rawImage, float scale) {
+	auto& codes = context.codes;
+	codes.clear();
+
+	// wrap image data
+	Image& zimage = context.image;
+	zimage.set_size(rawImage.cols, rawImage.rows);
+	zimage.set_data(rawImage.data, rawImage.rows * rawImage.cols);
+
+	// scan the image for barcodes
+	{
+		StageTimer timer(Stage::QRScan);
+		context.scanner.scan(zimage);
+	}
+
+	// Copy out every QR code first, the forms are scanned without touching zbar.
+	for (Image::SymbolIterator symbol = zimage.symbol_begin(); symbol != zimage.symbol_end(); ++symbol) {
+		if (symbol->get_type() == ZBAR_QRCODE) {
+			assert(symbol->get_location_size() == 4); // All QR codes have 4 corners
+			codes.emplace_back();
+			auto& code = codes.back();
+			code.Corners[0] = { static_cast<float>(symbol->get_location_x(0)), static_cast<float>(symbol->get_location_y(0)) };
+			code.Corners[1] = { static_cast<float>(symbol->get_location_x(3)), static_cast<float>(symbol->get_location_y(3)) };
+			code.Corners[2] = { static_cast<float>(symbol->get_location_x(2)), static_cast<float>(symbol->get_location_y(2)) };
+			code.Corners[3] = { static_cast<float>(symbol->get_location_x(1)), static_cast<float>(symbol->get_location_y(1)) };
+			for (auto& corner : code.Corners) {
+				corner *= scale;
+			}
+			code.Data = symbol->get_data();
+		}
+	}
+
+	// clean up
+	zimage.set_data(NULL, 0);
+	return codes.size();
+}
+
+vector<ScanResult>& scanForms(ScanContext& context, const cv::Mat& rawImage, float scale,
+		const cv::Size pageSize, const cv::Rect2f qrBox,
+		const map<string, SVGShape>& shapes) {
+	auto& codes = context.codes;
+	auto& results = context.results;
+
+	// Each form is registered and sampled on its own worker with its own scratch space.
+	while (context.forms.size() < codes.size()) {
+		context.forms.emplace_back(new FormScratch());
+	}
+	while (results.size() < codes.size()) {
+		if (context.spareResults.empty()) {
+			results.emplace_back();
+		} else {
+			results.push_back(move(context.spareResults.back()));
+			context.spareResults.pop_back();
+		}
+	}
+	context.scanned.assign(codes.size(), 0);
+
+	auto scan = [&](size_t i) {
+		context.scanned[i] = scanForm(context, *context.forms[i], codes[i], results[i],
+				rawImage, scale, pageSize, qrBox, shapes) ? 1 : 0;
+	};
+	context.workers.run(codes.size(), scan);
+
+	// Drop the forms whose page wasn't found. Their results are set aside rather than
+	// destroyed, so their buffers serve the next image with more forms.
+	size_t found = 0;
+	for (size_t i = 0; i < codes.size(); i++) {
+		if (context.scanned[i]) {
+			if (found != i) {
+				std::swap(results[found], results[i]);
+			}
+			found++;
+		}
+	}
+	for (size_t i = found; i < results.size(); i++) {
+		context.spareResults.push_back(move(results[i]));
+	}
+	results.resize(found);
+	return results;
+}
+
+void configureScanner(ImageScanner& scanner) {
+	scanner.set_config(ZBAR_QRCODE, ZBAR_CFG_ENABLE, 1);
+	scanner.set_config(ZBAR_QRCODE, ZBAR_CFG_POSITION, 1);
+}
@@ -0,0 +1,128 @@
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <zbar.h>
+#include <opencv2/core/core.hpp>
+
+#include "arena.h"
+#include "decode.h"
+#include "sheet.h"
+#include "threshold.h"
+#include "workers.h"
+
+struct ScanResult {
+	std::string qrData;
+	std::vector<float> fills; // Indexed by shape ordinal, see shapeIds().
+	cv::Mat preview;
+	int threshold = 0;
+	int fullThreshold = -1; // Full page Otsu level, if the context checks thresholds.
+	int escalated = 0;      // Bubbles the probe couldn't decide, see ScanSettings.
+	std::vector<GroupDecision> decisions; // One per group if the context has groups.
+};
+
+// How sheets are thresholded.
+struct ScanSettings {
+	ThresholdSampling thresholdSampling = ThresholdSampling::Full;
+	Lighting lighting = Lighting::Uniform;
+
+	// Probe a few rows of each bubble first and only blur and sample the whole bubble if
+	// the probe isn't clearly empty or clearly filled. The fill of a bubble the probe
+	// decides is that of its probe rows. Only used with ThresholdSampling::Reduced, the
+	// other levels blur every bubble anyway.
+	bool tieredSampling = false;
+
+	// Find QR codes in JPEGs decoded at 1/2, 1/4 or 1/8 resolution, see scanImageFile().
+	int detectScale = 1;
+
+	// Sample the shapes that only lay out the sheet too, so results have a fill for every
+	// shape in the SVG. Without them only bubbles are blurred, not most of the page. The
+	// scanner samples whatever shapes it is given; callers drop the layout shapes after
+	// loading the template, see omitLayoutShapes().
+	bool layoutShapes = true;
+};
+
+// Scratch space to scan one form. Buffers are sized by the first few sheets and
+// reused afterwards, so scanning in steady state doesn't allocate.
+struct FormScratch {
+	// Page-sized temporaries, released when the next sheet starts.
+	ScratchArena arena;
+	BitPage thresholded;
+
+	std::vector<std::vector<cv::Point>> contours;
+	std::vector<std::pair<double, size_t>> contourOrder; // Area and index, largest first.
+	std::vector<cv::Point> corners;
+	std::vector<std::vector<cv::Point>> outline;
+	std::vector<cv::Rect> regions; // Page border strips, then bubbles.
+	std::vector<cv::Mat> blurredRegions;
+	std::vector<float> probes; // Fill of each bubble from its probe, or -1 if escalated.
+};
+
+// A QR code found in an image, with its corners clockwise from the top left in full
+// resolution pixels.
+struct FormCode {
+	cv::Point2f Corners[4];
+	std::string Data;
+};
+
+// Everything one caller needs to scan images. The forms of an image are scanned in
+// parallel, each with scratch space of its own.
+// A context is not thread safe, give each caller its own.
+struct ScanContext {
+	ScanContext();
+	ScanContext(const ScanContext&) = delete;
+	ScanContext& operator=(const ScanContext&) = delete;
+
+	zbar::ImageScanner scanner;
+	zbar::Image image;
+
+	ScanSettings settings;
+	const std::vector<BubbleGroup>* groups = nullptr; // Decide these groups after sampling.
+	bool checkThreshold = false; // Also compute the full page Otsu level of each sheet.
+
+	std::vector<FormCode> codes;
+	size_t lastCodes = 0; // QR codes found in the last image, see scanDecoded().
+	std::vector<std::unique_ptr<FormScratch>> forms; // One per form of the busiest image so far.
+	std::vector<char> scanned; // Whether each form's page was found.
+	WorkerPool workers;
+
+	// Results of the last scan, including their previews.
+	std::vector<ScanResult> results;
+	std::vector<ScanResult> spareResults; // Of forms that weren't found, for their buffers.
+
+	// Bytes of scratch space held by all forms.
+	size_t arenaCapacity() const;
+};
+
+void sortPointsCW(std::vector<cv::Point>& points);
+std::vector<cv::Point2f> rectCorners(cv::Rect2f rect);
+void rectCorners(cv::Rect2f rect, cv::Point2f outCorners[4]);
+
+// outPage is taken from the scratch arena.
+bool tryFindPage(FormScratch& scratch, const cv::Mat& inPage, cv::Mat& outPage,
+		const cv::Point2f srcQRCorners[4], cv::Size pageSize, cv::Rect2f qrBox);
+
+// Find every form in an image by its QR code and sample the fill of each shape.
+// Forms are scanned in parallel, and a form whose page can't be found is left out
+// without affecting the others. The results are in QR code order, belong to the
+// context and are valid until its next scan.
+std::vector<ScanResult>& scanImage(ScanContext& context, const cv::Mat& rawImage,
+		const cv::Size pageSize, const cv::Rect2f qrBox,
+		const std::map<std::string, SVGShape>& shapes);
+
+// The two halves of scanImage, which may see the image at different resolutions.
+// The image is reduced by scale, e.g. 4 for a quarter resolution decode. findCodes
+// keeps the QR codes in the context, and scanForms scans the form of each.
+size_t findCodes(ScanContext& context, const cv::Mat& rawImage, float scale);
+std::vector<ScanResult>& scanForms(ScanContext& context, const cv::Mat& rawImage, float scale,
+		const cv::Size pageSize, const cv::Rect2f qrBox,
+		const std::map<std::string, SVGShape>& shapes);
+
+// Configure the QR code reader
+void configureScanner(zbar::ImageScanner& scanner);
+
+#endif
@@ -1,7 +1,11 @@
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <map>
+#include <mutex>
 #include <vector>
 
 #include <zbar.h>
@@ -10,7 +14,21 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
-#include "nanosvg.h"
+#include "sheet.h"
+#include "decode.h"
+#include "output.h"
+#include "matchstore.h"
+#include "validate.h"
+#include "aggregate.h"
+#include "timing.h"
+#include "scanner.h"
+#include "bench.h"
+#include "server.h"
+#include "framering.h"
+#include "workqueue.h"
+#include "resultcache.h"
+#include "journal.h"
+#include "ingest.h"
 
 using namespace std;
 using namespace zbar;
@@ -22,262 +40,455 @@ const int KEY_Q = 113;
 const int KEY_A = 97;
 const int KEY_SPACE = 32;
 
-struct SVGShape {
-	SVGShape() = default;
-
-	SVGShape(NSVGshape* shape) :
-		Id { shape->id },
-		BoundingBox {
-			shape->bounds[0],
-			shape->bounds[1],
-			shape->bounds[2] - shape->bounds[0],
-			shape->bounds[3] - shape->bounds[1] }
-	{
-		for (auto path = shape->paths; path != nullptr; path = path->next) {
-			for (auto i = 0; i < path->npts; i++) {
-				Outline.push_back(
-						cv::Point2f(path->pts[i * 2], path->pts[i * 2 + 1]));
-			}
-		}
-	}
-
-	string Id;
-	vector<cv::Point> Outline;
-	cv::Rect2f BoundingBox;
+// Everything an accepted sheet is committed to.
+struct Output {
+	ResultWriter& writer;
+	const vector<string>& shapeIds;
+	const vector<BubbleGroup>* groups; // Write group decisions instead of raw fills.
+	const FieldSchema* schema;
+	const RuleProgram* rules;
+	MatchStore* store;
+	bool overwrite;
+	Aggregates* aggregates;
 };
 
-void sortPointsCW(vector<cv::Point>& points) {
-	std::sort(points.begin(), points.end(),
-			[](cv::Point pt1, cv::Point pt2) {return (pt1.y < pt2.y);});
-	std::sort(points.begin(), points.begin() + 2,
-			[](cv::Point pt1, cv::Point pt2) {return (pt1.x < pt2.x);});
-	std::sort(points.begin() + 2, points.end(),
-			[](cv::Point pt1, cv::Point pt2) {return (pt1.x > pt2.x);});
-}
-
-vector<cv::Point2f> rectCorners(cv::Rect2f rect) {
-	return {
-		rect.tl(),
-		{rect.x + rect.width, rect.y},
-		rect.br(),
-		{rect.x, rect.y + rect.height}
-	};
-}
-
-bool tryFindPage(cv::Mat inPage, cv::Mat& outPage, vector<cv::Point2f> srcQRCorners,
-		cv::Size pageSize, cv::Rect2f qrBox) {
-	// Estimate the transformation using the location from the QR code
-	auto perspectiveTransform = cv::getPerspectiveTransform(srcQRCorners,
-			rectCorners(qrBox));
-
-	// Zoom out to include a larger area around the page to ensure we've got the whole page.
-	double scaleFactor = 0.7;
-	auto scale = cv::getRotationMatrix2D(
-			{ pageSize.width / 2.0f, pageSize.height / 2.0f }, 0, scaleFactor);
-	scale.push_back(cv::Mat::zeros(1, 3, CV_64F));
-	scale.at<double>(2, 2) = 1.0;
-	cv::Mat scalePerspective = scale * perspectiveTransform;
-	cv::Mat warped;
-	cv::warpPerspective(inPage, warped, scalePerspective, pageSize);
-
-	// Blur to remove noise.
-	cv::Mat blurred;
-	cv::GaussianBlur(warped, blurred, { }, 1, 1);
-
-	// Find edges
-	cv::Mat edged;
-	cv::Canny(blurred, edged, 75, 200);
-
-	// Find contours.
-	vector<vector<cv::Point>> contours { };
-	cv::findContours(edged, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_NONE);
-
-	// Sort contours by area
-	std::sort(contours.begin(), contours.end(),
-		[](vector<cv::Point> a, vector<cv::Point> b)
-		{ return cv::contourArea(a) > cv::contourArea(b); });
-
-	for (auto& contour : contours) {
-		// Convert contours to polygon vertices.
-		vector<cv::Point> corners { };
-		cv::approxPolyDP(contour, corners, 0.05 * cv::arcLength(contour, true),
-				true);
-
-		// Look for 4-cornered shapes
-		if (corners.size() == 4) {
-			// Check that the area is large enough to likely be our box.
-			double area = cv::contourArea(contour) / scaleFactor;
-			if (area / pageSize.area() < 0.5) {
-				break; // Area square too small.
-			}
+// A sheet decoded with the field schema, and the messages of any failed checks.
+struct CheckedRecord {
+	vector<DecodedField> fields;
+	string errors;
+};
 
-			// Order the points.
-			sortPointsCW(corners);
+// Decode and validate a sheet. Validation errors are drawn on the preview so that
+// they're seen before the sheet is accepted.
+CheckedRecord checkResult(const Output& output, ScanResult& result) {
+	CheckedRecord checked;
+	if (output.schema == nullptr) {
+		return checked;
+	}
 
-			// Convert from Point to Point2f
-			vector<cv::Point2f> corners2f;
-			cv::Mat(corners).copyTo(corners2f);
+	checked.fields = decodeRecord(*output.schema, result.fills, result.qrData);
+	if (output.rules != nullptr) {
+		checked.errors = validateRecord(*output.rules, checked.fields);
+	}
 
-			cv::Rect2f pageBox { { }, pageSize };
-			vector<cv::Point2f> pageCorners = rectCorners(pageBox);
+	istringstream errors(checked.errors);
+	string error;
+	for (int line = 1; getline(errors, error); line++) {
+		cerr << error << endl;
+		if (result.preview.empty()) {
+			continue; // Results from the cache have no preview.
+		}
+		cv::putText(result.preview, error, { 10, 40 * line }, cv::FONT_HERSHEY_SIMPLEX, 1.2,
+				{ 0, 0, 255 }, 2);
+	}
+	return checked;
+}
 
-			// Compute the transform to the corners of the rectangle
-			auto finalPerspective = cv::getPerspectiveTransform(corners2f, pageCorners);
-			cv::warpPerspective(inPage, outPage, finalPerspective * scalePerspective, pageSize);
+void commitResult(Output& output, const ScanResult& result, const CheckedRecord& checked) {
+	StageTimer timer(Stage::Output);
 
-			cv::Mat mask;
-			return true;
+	if (output.schema == nullptr) {
+		if (output.groups != nullptr) {
+			output.writer.writeGroups(result.qrData, *output.groups, result.decisions);
+		} else {
+			output.writer.writeResult(result.qrData, output.shapeIds, result.fills);
 		}
+		return;
 	}
 
-	// Failed to find corners.
-	return false;
-}
+	output.writer.writeRecord(*output.schema, checked.fields,
+			output.rules != nullptr ? &checked.errors : nullptr);
 
-// Find all the shapes in an SVG file.
-// Output is a map of SVG ID to shape
-map<string, SVGShape> findSVGShapes(const string filename, cv::Size& outPageSize) {
-	map<string, SVGShape> shapes;
-	NSVGimage* image = nullptr;
+	if (!checked.errors.empty()) {
+		if (output.store != nullptr || output.aggregates != nullptr) {
+			cerr << "Invalid match was not stored." << endl;
+		}
+		return;
+	}
 
-	image = nsvgParseFromFile(filename.c_str(), "px", 150.0f);
-	if (image == nullptr) {
-		return {};
+	vector<string> row;
+	for (auto&& field : checked.fields) {
+		row.push_back(field.Text);
 	}
 
-	outPageSize = {static_cast<int>(image->width), static_cast<int>(image->height)};
+	vector<string> previous;
+	MatchStore::PutResult stored = MatchStore::PutResult::Added;
+	if (output.store != nullptr) {
+		if (auto existing = output.store->find(row)) {
+			previous = *existing;
+		}
 
-	for (auto shape = image->shapes; shape != nullptr; shape = shape->next) {
-		shapes[shape->id] = SVGShape(shape);
+		if (!output.store->put(row, output.overwrite, stored)) {
+			cerr << "Error: Could not store match" << endl;
+			return;
+		} else if (stored == MatchStore::PutResult::Duplicate) {
+			cerr << "Match has already been scanned, skipped." << endl;
+		} else if (stored == MatchStore::PutResult::Overwritten) {
+			cerr << "Match has already been scanned, overwrote previous scan." << endl;
+		}
 	}
 
-	nsvgDelete(image);
+	if (output.aggregates != nullptr && stored != MatchStore::PutResult::Duplicate) {
+		if (stored == MatchStore::PutResult::Overwritten) {
+			output.aggregates->remove(previous);
+		}
+		output.aggregates->add(row);
+		if (!output.aggregates->saveIfDue()) {
+			cerr << "Error: Could not save statistics" << endl;
+		}
+	}
+}
 
-	return shapes;
+// What a form says: its QR code and decoded record, or which bubbles are filled without
+// a schema. A sheet held under a camera for several frames has the same key in each.
+string recordKey(const Output& output, const ScanResult& result) {
+	string key = result.qrData;
+	if (output.schema != nullptr) {
+		for (auto&& field : decodeRecord(*output.schema, result.fills, result.qrData)) {
+			key += '\x1f';
+			key += field.Text;
+		}
+	} else {
+		key += '\x1f';
+		for (auto fill : result.fills) {
+			key += fill > FILL_THRESHOLD ? '1' : '0';
+		}
+	}
+	return key;
 }
 
-struct ScanResult {
-	map<string, double> values;
-	cv::Mat preview;
+struct Options {
+	string fieldsFile;
+	OutputFormat format = OutputFormat::NDJSON;
+	bool formatSpecified = false;
+	FlushPolicy flushPolicy = FlushPolicy::Batch;
+	bool flushSpecified = false;
+	string storeFile;
+	bool overwrite = false;
+	string importFile;
+	string exportFile;
+	string statsFile;
+	string timingsFile;
+	string traceFile;
+	int benchSheets = 0;
+	unsigned seed = 1;
+	string goldenFile;
+	bool recordGolden = false;
+	ScanSettings settings;
+	bool groupResults = false;
+	bool resultsSpecified = false;
+	string serveAddress;
+	string replayRing;
+	string queueDirectory;
+	string node;
+	string cacheFile;
+	string batchDirectory;
+	string journalFile;
+	string outputFile;
+	vector<string> arguments;
 };
 
-vector<ScanResult> scanImage(ImageScanner& scanner, const cv::Mat& rawImage,
-		const cv::Size pageSize, const cv::Rect2f qrBox,
-		const map<string, SVGShape>& shapes) {
-
-	vector<ScanResult> results;
-
-	// wrap image data
-	Image zimage(rawImage.cols, rawImage.rows, "Y800", rawImage.data, rawImage.rows * rawImage.cols);
-
-	// scan the image for barcodes
-	scanner.scan(zimage);
-
-	for (Image::SymbolIterator symbol = zimage.symbol_begin(); symbol != zimage.symbol_end(); ++symbol) {
-		if (symbol->get_type() == ZBAR_QRCODE) {
-			assert(symbol->get_location_size() == 4); // All QR codes have 4 corners
-			vector<cv::Point2f> qrCorners {
-				{ static_cast<float>(symbol->get_location_x(0)), static_cast<float>(symbol->get_location_y(0)) },
-				{ static_cast<float>(symbol->get_location_x(3)), static_cast<float>(symbol->get_location_y(3)) },
-				{ static_cast<float>(symbol->get_location_x(2)), static_cast<float>(symbol->get_location_y(2)) },
-				{ static_cast<float>(symbol->get_location_x(1)), static_cast<float>(symbol->get_location_y(1)) }
-			};
-
-			map<string, double> bubbles;
-			string data = symbol->get_data();
-
-			cv::Mat warped;
-			if (tryFindPage(rawImage, warped, qrCorners, pageSize, qrBox)) {
-				cv::Mat preview;
-				cv::cvtColor(warped, preview, cv::COLOR_GRAY2BGR);
-
-				cv::Mat blurred;
-				cv::GaussianBlur(warped, blurred, { }, 3, 3);
+bool parseOptions(int argc, char **argv, Options& outOptions) {
+	int arg = 1;
+	for (; arg < argc && string(argv[arg]).compare(0, 2, "--") == 0; arg++) {
+		string option(argv[arg]);
+		if (arg + 1 >= argc) {
+			return false;
+		}
 
-				cv::Mat thresholded;
-				cv::threshold(blurred, thresholded, 0, 255,
-						cv::THRESH_BINARY_INV | cv::THRESH_OTSU);
+		string value(argv[++arg]);
+		bool valid = true;
+		if (option == "--fields") {
+			outOptions.fieldsFile = value;
+		} else if (option == "--format") {
+			valid = outOptions.formatSpecified = parseOutputFormat(value, outOptions.format);
+		} else if (option == "--flush") {
+			valid = outOptions.flushSpecified = parseFlushPolicy(value, outOptions.flushPolicy);
+		} else if (option == "--store") {
+			outOptions.storeFile = value;
+		} else if (option == "--duplicates") {
+			valid = value == "skip" || value == "overwrite";
+			outOptions.overwrite = value == "overwrite";
+		} else if (option == "--import-csv") {
+			outOptions.importFile = value;
+		} else if (option == "--export-csv") {
+			outOptions.exportFile = value;
+		} else if (option == "--stats") {
+			outOptions.statsFile = value;
+		} else if (option == "--timings") {
+			outOptions.timingsFile = value;
+		} else if (option == "--trace") {
+			outOptions.traceFile = value;
+		} else if (option == "--bench") {
+			outOptions.benchSheets = atoi(value.c_str());
+			valid = outOptions.benchSheets > 0;
+		} else if (option == "--seed") {
+			outOptions.seed = static_cast<unsigned>(strtoul(value.c_str(), nullptr, 10));
+		} else if (option == "--threshold") {
+			valid = parseThresholdSampling(value, outOptions.settings.thresholdSampling);
+		} else if (option == "--lighting") {
+			valid = parseLighting(value, outOptions.settings.lighting);
+		} else if (option == "--sampling") {
+			valid = value == "full" || value == "tiered";
+			outOptions.settings.tieredSampling = value == "tiered";
+		} else if (option == "--shapes") {
+			valid = value == "all" || value == "bubbles";
+			outOptions.settings.layoutShapes = value == "all";
+		} else if (option == "--detect-scale") {
+			valid = parseDetectScale(value, outOptions.settings.detectScale);
+		} else if (option == "--results") {
+			valid = value == "fills" || value == "groups";
+			outOptions.groupResults = value == "groups";
+			outOptions.resultsSpecified = true;
+		} else if (option == "--serve") {
+			outOptions.serveAddress = value;
+		} else if (option == "--queue") {
+			outOptions.queueDirectory = value;
+		} else if (option == "--node") {
+			outOptions.node = value;
+		} else if (option == "--batch") {
+			outOptions.batchDirectory = value;
+		} else if (option == "--journal") {
+			outOptions.journalFile = value;
+		} else if (option == "--output") {
+			outOptions.outputFile = value;
+		} else if (option == "--cache") {
+			outOptions.cacheFile = value;
+		} else if (option == "--replay-ring") {
+			outOptions.replayRing = value;
+		} else if (option == "--golden" || option == "--record-golden") {
+			outOptions.goldenFile = value;
+			outOptions.recordGolden = option == "--record-golden";
+		} else {
+			valid = false;
+		}
 
-				{
-					cv::Mat mask(thresholded.rows, thresholded.cols, thresholded.type(), 255);
-					cv::rectangle(mask, {5, 5}, {mask.cols - 5, mask.rows - 5}, 0, -1, 0);
+		if (!valid) {
+			return false;
+		}
+	}
 
-					double mean = cv::mean(thresholded, mask).val[0] / 255.0;
-					if (mean < 0.75) {
-						break;
-					}
-				}
+	outOptions.arguments.assign(argv + arg, argv + argc);
+	return true;
+}
 
-				cv::Mat threshColor;
-				cv::cvtColor(thresholded, threshColor, cv::COLOR_GRAY2BGR);
+void printUsage(const char* program) {
+	cout << "Usage: " << program << " [Options] SvgFile [ImageFile | CameraNumber | shm:RingName]" << endl
+		<< "       " << program << " --store LogFile [--import-csv CsvFile] [--export-csv CsvFile] [--fields FieldsFile --stats CsvFile]" << endl
+		<< "       " << program << " --bench Sheets [--seed N] SvgFile..." << endl
+		<< "       " << program << " --golden|--record-golden CsvFile SvgFile ImageDirectory" << endl
+		<< "       " << program << " --serve SocketPath|tcp:Port [Options] SvgFile" << endl
+		<< "       " << program << " --replay-ring RingName ImageFile..." << endl
+		<< "       " << program << " --queue ImageDirectory [--node Name] [--cache CacheFile] [--timings -|JsonFile] [--trace JsonFile] [Scan options] SvgFile" << endl
+		<< "       " << program << " --batch ImageDirectory [--journal JournalFile --output OutputFile] [Options] SvgFile" << endl
+		<< "Options:" << endl
+		<< "  --fields FieldsFile       Output records decoded and validated with a field schema" << endl
+		<< "  --format ndjson|csv|binary  Output format (default ndjson)" << endl
+		<< "  --flush record|batch      Flush after every record or in batches" << endl
+		<< "                            (default record for cameras, batch for files)" << endl
+		<< "  --results fills|groups    Without --fields, write every bubble fill or one" << endl
+		<< "                            decision and margin per bubble group (default fills)" << endl
+		<< "  --store LogFile           Also commit decoded records to a match store" << endl
+		<< "  --duplicates skip|overwrite  What to do with already stored matches (default skip)" << endl
+		<< "  --import-csv CsvFile      Add the rows of a CSV file to the match store" << endl
+		<< "  --export-csv CsvFile      Write the match store as CSV for RoverRuckus.twb" << endl
+		<< "  --stats CsvFile           Keep per-team statistics of the matches in the --store" << endl
+		<< "  --timings -|JsonFile      Time each stage and print percentiles at exit," << endl
+		<< "                            or write them to a JSON file" << endl
+		<< "  --trace JsonFile          Write a chrome://tracing timeline of every stage at exit" << endl
+		<< "  --threshold full|reduced|bubbles  Pixels the Otsu level is computed from" << endl
+		<< "                            (default full)" << endl
+		<< "  --lighting uniform|uneven  Threshold each bubble against its surroundings" << endl
+		<< "                            for unevenly lit camera shots (default uniform)" << endl
+		<< "  --sampling full|tiered    With --threshold reduced, decide obvious bubbles from a" << endl
+		<< "                            quick probe and sample only the uncertain ones in full" << endl
+		<< "                            (default full)" << endl
+		<< "  --shapes all|bubbles      Sample and write every shape in the SVG, or only the" << endl
+		<< "                            bubbles, skipping the page border (default all)" << endl
+		<< "  (Scan options are --threshold, --lighting, --sampling, --shapes and --detect-scale.)" << endl
+		<< "  --serve SocketPath|tcp:Port  Keep the template loaded and scan images sent by" << endl
+		<< "                            local clients over a Unix socket or loopback TCP" << endl
+		<< "  --queue ImageDirectory    Scan a directory shared with other nodes, claiming images" << endl
+		<< "                            with expiring leases, and print the merged results" << endl
+		<< "  --node Name               Name of this node's result shard (default host-pid)" << endl
+		<< "  --batch ImageDirectory    Scan and commit every image in a directory without review" << endl
+		<< "  --journal JournalFile     Record the progress of --batch so that a restarted run" << endl
+		<< "                            skips finished images and writes each record once" << endl
+		<< "  --output OutputFile       Write records to a file instead of stdout, with --journal" << endl
+		<< "  --cache CacheFile         With --queue, --serve or --batch, answer images that were" << endl
+		<< "                            scanned before with the same template and settings from a cache" << endl
+		<< "  --replay-ring RingName    Stand in for a capture process and publish image files" << endl
+		<< "                            into a shared memory frame ring, read with shm:RingName" << endl
+		<< "  --detect-scale 1|2|4|8    Find QR codes in JPEG files decoded at reduced scale" << endl
+		<< "                            and decode no more than sampling needs (default 1)" << endl
+		<< "  --bench Sheets            Scan generated sheets and report speed and accuracy" << endl
+		<< "  --seed N                  First random seed of generated sheets (default 1)" << endl
+		<< "  --golden CsvFile          Scan a directory of real sheets and report fills that cross" << endl
+		<< "                            the threshold differently from a recorded run" << endl
+		<< "  --record-golden CsvFile   Record the fills of a directory of sheets for --golden" << endl;
+}
 
-				vector<vector<cv::Point>> shapeVector(1);
+// Import into and export from the match store without scanning. Statistics, if
+// given, are brought up to date with the imported rows.
+int maintainStore(const Options& options, const vector<string>& columns) {
+	MatchStore store;
+	if (!store.open(options.storeFile, columns)) {
+		return -1;
+	}
+	if (!options.importFile.empty() && !store.importCsv(options.importFile)) {
+		return -1;
+	}
+	if (!options.statsFile.empty()) {
+		if (options.fieldsFile.empty()) {
+			cout << "Error: --stats requires --fields" << endl;
+			return -1;
+		}
+		Aggregates aggregates;
+		if (!aggregates.open(options.statsFile, options.fieldsFile, store.fieldNames(), store)) {
+			return -1;
+		}
+	}
+	if (!options.exportFile.empty() && !store.exportCsv(options.exportFile)) {
+		return -1;
+	}
+	cerr << store.size() << " matches in " << options.storeFile << endl;
+	return 0;
+}
 
-				for (auto&& shape : shapes) {
-					shapeVector[0] = shape.second.Outline;
-					cv::Mat mask = cv::Mat::zeros(thresholded.rows, thresholded.cols, thresholded.type());
-					cv::drawContours(mask, shapeVector, 0, 255, -1);
+int main(int argc, char **argv) {
+	Options options;
+	if (!parseOptions(argc, argv, options)) {
+		printUsage(argv[0]);
+		return -1;
+	}
 
-					double filled = cv::mean(thresholded, mask).val[0] / 255.0;
+	if (!options.storeFile.empty() && options.arguments.empty()) {
+		return maintainStore(options, { });
+	}
 
-					{
-						double green = (filled > 0.3 ? 1 : 0) * 255;
-						double red = 255 - green;
-						cv::drawContours(preview, shapeVector, -1, { 0, green, red }, 1);
-					}
-					{
-						double green = (filled) * 255;
-						double red = 255 - green;
-						cv::drawContours(threshColor, shapeVector, -1, { 0, green, red }, 2);
-					}
-					bubbles[shape.first] = filled;
-				}
+	if (!options.replayRing.empty()) {
+		if (options.arguments.empty()) {
+			printUsage(argv[0]);
+			return -1;
+		}
+		return replayFrames(options.replayRing, options.arguments);
+	}
 
-				cv::Mat combinedView;
-				cv::hconcat(preview, threshColor, combinedView);
-				results.push_back(ScanResult { bubbles, combinedView });
-			}
+	if (!options.queueDirectory.empty()) {
+		if (options.arguments.size() != 1) {
+			printUsage(argv[0]);
+			return -1;
 		}
+		// Every node prints the same merged rows in the golden file format, so options that
+		// shape or commit the output of one node don't apply.
+		if (!options.fieldsFile.empty() || options.formatSpecified || options.flushSpecified
+				|| options.resultsSpecified || !options.storeFile.empty() || !options.statsFile.empty()
+				|| !options.batchDirectory.empty() || !options.journalFile.empty()
+				|| !options.outputFile.empty() || !options.serveAddress.empty()) {
+			cerr << "Error: --queue writes the merged fills of every form and can't be combined with"
+					<< " --fields, --format, --flush, --results, --store, --stats, --batch, --journal,"
+					<< " --output or --serve" << endl;
+			return -1;
+		}
+		ResultCache cache;
+		if (!options.cacheFile.empty()
+				&& !cache.open(options.cacheFile, scanKey(options.arguments[0], options.settings))) {
+			return -1;
+		}
+		timingsEnabled = !options.timingsFile.empty();
+		tracingEnabled = !options.traceFile.empty();
+		setTraceThreadName("main");
+		int status = runWorkQueue(options.queueDirectory, options.node, options.arguments[0],
+				options.settings, options.cacheFile.empty() ? nullptr : &cache);
+		reportTimings(options.timingsFile);
+		if (tracingEnabled) {
+			writeTrace(options.traceFile);
+		}
+		return status;
 	}
 
-	// clean up
-	zimage.set_data(NULL, 0);
-	return results;
-}
+	if (options.benchSheets > 0) {
+		if (options.arguments.empty()) {
+			printUsage(argv[0]);
+			return -1;
+		}
+		tracingEnabled = !options.traceFile.empty();
+		int status = runBenchmark(options.arguments, options.benchSheets, options.seed,
+				options.settings);
+		if (tracingEnabled) {
+			writeTrace(options.traceFile);
+		}
+		return status;
+	}
 
-void printResult(map<string, double> result) {
-	bool first = true;
-	cout << "{";
-	for (auto&& field : result) {
-		if (first) {
-			first = false;
-		} else {
-			cout << ',';
+	if (!options.goldenFile.empty()) {
+		if (options.arguments.size() != 2) {
+			printUsage(argv[0]);
+			return -1;
 		}
-		cout << '"' << field.first << "\":" << field.second;
+		tracingEnabled = !options.traceFile.empty();
+		int status = runGoldenBenchmark(options.arguments[0], options.arguments[1],
+				options.goldenFile, options.recordGolden, options.settings);
+		if (tracingEnabled) {
+			writeTrace(options.traceFile);
+		}
+		return status;
 	}
-	cout << "}" << endl;
-}
 
-int main(int argc, char **argv) {
-	if (argc < 3) {
-		cout << "Usage: " << argv[0] << " SvgFile [ImageFile | CameraNumber]" << endl;
+	bool serving = !options.serveAddress.empty();
+	bool batch = !options.batchDirectory.empty();
+	if (options.arguments.size() != (serving || batch ? 1 : 2)) {
+		printUsage(argv[0]);
+		return -1;
+	}
+	if (serving && batch) {
+		cout << "Error: --serve and --batch can't be used together" << endl;
 		return -1;
 	}
+	if (!options.cacheFile.empty() && !serving && !batch) {
+		cout << "Error: --cache goes with --queue, --serve or --batch" << endl;
+		return -1;
+	}
+
+	timingsEnabled = !options.timingsFile.empty();
+	tracingEnabled = !options.traceFile.empty();
+	setTraceThreadName("main");
 
-	string svgFile(argv[1]);
-	string imageName(argv[2]);
+	string svgFile(options.arguments[0]);
+	string imageName(serving || batch ? "" : options.arguments[1]);
 
 	int camera(-1);
 	bool liveCapture(false);
+	string ringName;
 
 	// Use live capture if a camera number is specified.
 	if (imageName.size() == 1 && imageName[0] >= '0' && imageName[0] <= '9') {
 		camera = imageName[0] - '0';
 		liveCapture = true;
+	} else if (imageName.compare(0, 4, "shm:") == 0) {
+		// Scan frames a capture process writes into shared memory.
+		ringName = imageName.substr(4);
 	}
 
-	cv::namedWindow(windowName, cv::WINDOW_NORMAL);
+	// Live capture feeds an interactive consumer, so don't hold records back.
+	if ((liveCapture || !ringName.empty()) && !options.flushSpecified) {
+		options.flushPolicy = FlushPolicy::Record;
+	}
+
+	// A journaled batch writes to a file the journal can roll back.
+	Journal journal;
+	if (!options.journalFile.empty() || !options.outputFile.empty()) {
+		if (!batch || options.journalFile.empty() || options.outputFile.empty()) {
+			cout << "Error: --journal and --output go together with --batch" << endl;
+			return -1;
+		}
+		if (!journal.open(options.journalFile, options.outputFile)) {
+			return -1;
+		}
+	}
+	if (!serving && !batch && ringName.empty()) {
+		cv::namedWindow(windowName, cv::WINDOW_NORMAL);
+	}
 
 	cv::Size pageSize;
 	map<string, SVGShape> shapes = findSVGShapes(svgFile, pageSize);
@@ -289,16 +500,179 @@ int main(int argc, char **argv) {
 
 	// Find the QR code location in the SVG
 	cv::Rect2f qrBox = shapes["qr"].BoundingBox;
+	if (!options.settings.layoutShapes) {
+		omitLayoutShapes(shapes);
+	}
+
+	// Decode records natively if a field schema is given, otherwise print raw bubble fills.
+	auto groups = compileBubbleGroups(shapes);
+	FieldSchema fieldSchema;
+	if (!options.fieldsFile.empty() && !loadFieldSchema(options.fieldsFile, groups, fieldSchema)) {
+		return -1;
+	}
+	const FieldSchema* schema = options.fieldsFile.empty() ? nullptr : &fieldSchema;
 
-	// Configure the QR code reader
-	ImageScanner scanner { };
-	scanner.set_config(ZBAR_QRCODE, ZBAR_CFG_ENABLE, 1);
-	scanner.set_config(ZBAR_QRCODE, ZBAR_CFG_POSITION, 1);
+	// Validate records with the checks declared alongside the fields.
+	RuleProgram ruleProgram;
+	if (schema != nullptr && !loadRules(options.fieldsFile, *schema, ruleProgram)) {
+		return -1;
+	}
+	const RuleProgram* rules = ruleProgram.Rules.empty() ? nullptr : &ruleProgram;
+
+	// Commit decoded records to the match store, keyed on the schema's columns.
+	MatchStore matchStore;
+	if (!options.storeFile.empty()) {
+		if (schema == nullptr) {
+			cout << "Error: --store requires --fields" << endl;
+			return -1;
+		}
+
+		vector<string> columns;
+		for (auto&& field : schema->Fields) {
+			columns.push_back(field.Name);
+		}
+		if (!matchStore.open(options.storeFile, columns)) {
+			return -1;
+		}
+	}
+
+	// Keep the dashboard statistics up to date, rebuilding them from the store if needed.
+	Aggregates aggregates;
+	if (!options.statsFile.empty()) {
+		if (options.storeFile.empty()) {
+			cout << "Error: --stats requires --store" << endl;
+			return -1;
+		}
+		if (!aggregates.open(options.statsFile, options.fieldsFile, matchStore.fieldNames(), matchStore)) {
+			return -1;
+		}
+	}
+
+	auto ids = shapeIds(shapes);
+	const vector<BubbleGroup>* outputGroups = options.groupResults ? &groups : nullptr;
+	MatchStore* store = options.storeFile.empty() ? nullptr : &matchStore;
+	Aggregates* stats = options.statsFile.empty() ? nullptr : &aggregates;
+
+	ResultCache resultCache;
+	if (!options.cacheFile.empty()
+			&& !resultCache.open(options.cacheFile, scanKey(svgFile, options.settings))) {
+		return -1;
+	}
+	ResultCache* cache = options.cacheFile.empty() ? nullptr : &resultCache;
+
+	if (serving) {
+		// Clients scan in parallel, but records are committed one at a time.
+		mutex commitMutex;
+		ScanTemplate sheet { &shapes, pageSize, qrBox, options.settings,
+				options.groupResults ? &groups : nullptr, cache };
+		int status = runServer(options.serveAddress, sheet, options.format,
+				[&](ResultWriter& clientWriter, vector<ScanResult>& results) {
+			Output clientOutput { clientWriter, ids, outputGroups, schema, rules, store,
+					options.overwrite, stats };
+			for (auto&& result : results) {
+				auto checked = checkResult(clientOutput, result);
+				lock_guard<mutex> lock(commitMutex);
+				commitResult(clientOutput, result, checked);
+			}
+		});
+		reportTimings(options.timingsFile);
+		if (tracingEnabled) {
+			writeTrace(options.traceFile);
+		}
+		return status;
+	}
+
+	// Records go to stdout, or to the output file of a journaled batch. Served records
+	// only go to their clients.
+	ResultWriter writer(journal.output() != nullptr ? journal.output() : stdout, options.format,
+			options.flushPolicy);
+	if (journal.resumed()) {
+		writer.resume();
+	}
+	Output output { writer, ids, outputGroups, schema, rules, store, options.overwrite, stats };
+
+	// Buffers and QR code reader reused for every scan
+	ScanContext context;
+	context.settings = options.settings;
+	if (options.groupResults) {
+		context.groups = &groups;
+	}
 
 	cv::Mat rawImage;
 	cv::VideoCapture cap;
 
-	if (liveCapture) {
+	if (batch) {
+		auto images = listImages(options.batchDirectory);
+		if (journal.doneCount() > 0) {
+			cerr << "Resuming, " << journal.doneCount() << " of " << images.size()
+					<< " images were already scanned." << endl;
+		}
+
+		vector<unsigned char> bytes;
+		vector<ScanResult> cached;
+		for (auto&& image : images) {
+			if (journal.isDone(image)) {
+				continue;
+			}
+			readFileBytes(options.batchDirectory + "/" + image, bytes);
+			auto scanned = scanEncoded(context, cache, bytes, pageSize, qrBox, shapes, cached);
+			if (scanned == nullptr) {
+				cerr << "Error: Could not read " << image << endl;
+				continue;
+			}
+
+			auto& results = *scanned;
+			for (auto&& result : results) {
+				auto checked = checkResult(output, result);
+				commitResult(output, result, checked);
+			}
+
+			if (journal.output() != nullptr) {
+				journal.add(image, static_cast<long>(results.size()));
+				if (journal.commitDue()) {
+					writer.flush();
+					if (!journal.commit()) {
+						return -1;
+					}
+				}
+			}
+		}
+
+		writer.flush();
+		if (journal.output() != nullptr && !journal.commit()) {
+			return -1;
+		}
+	} else if (!ringName.empty()) {
+		FrameRing ring;
+		if (!ring.open(ringName)) {
+			return -1;
+		}
+
+		// Frames are scanned in place and every form found is committed, there is no
+		// one at the station to review them. A form that reads the same as in the frame
+		// before is still the same sheet under the camera and is committed only once.
+		vector<string> previousKeys, keys;
+		while (ring.next(rawImage)) {
+			auto& results = scanImage(context, rawImage, pageSize, qrBox, shapes);
+			if (!ring.intact()) {
+				cerr << "Frame was overwritten while it was scanned, skipped." << endl;
+				continue;
+			}
+			keys.clear();
+			for (auto&& result : results) {
+				keys.push_back(recordKey(output, result));
+				if (find(previousKeys.begin(), previousKeys.end(), keys.back()) != previousKeys.end()) {
+					continue;
+				}
+				auto checked = checkResult(output, result);
+				commitResult(output, result, checked);
+			}
+			swap(previousKeys, keys);
+		}
+		if (ring.skipped() > 0) {
+			cerr << ring.skipped() << " frames were skipped because scanning fell behind." << endl;
+		}
+	} else if (liveCapture) {
 		cap = cv::VideoCapture(camera); // open the default camera
 		if (!cap.isOpened()) { // check if we succeeded
 			cout << "Failed to open camera" << endl;
@@ -312,8 +686,11 @@ int main(int argc, char **argv) {
 		while (true) {
 			int key;
 			cv::Mat frame;
-			cap >> frame; // get a new frame from camera
-			cv::cvtColor(frame, rawImage, cv::COLOR_BGR2GRAY);
+			{
+				StageTimer timer(Stage::ImageLoad);
+				cap >> frame; // get a new frame from camera
+				cv::cvtColor(frame, rawImage, cv::COLOR_BGR2GRAY);
+			}
 
 			imshow(windowName, rawImage);
 
@@ -327,7 +704,7 @@ int main(int argc, char **argv) {
 			}
 
 			if (scanRequested) {
-				auto results = scanImage(scanner, rawImage, pageSize, qrBox, shapes);
+				auto& results = scanImage(context, rawImage, pageSize, qrBox, shapes);
 
 				if (results.size() > 0) {
 					cerr << "Found " << results.size() << " successful form." << endl;
@@ -335,31 +712,41 @@ int main(int argc, char **argv) {
 				}
 
 				for (auto&& result : results) {
+					auto checked = checkResult(output, result);
 					imshow(windowName, result.preview);
 					if (cv::waitKey(0) == KEY_A) {
-						printResult(result.values);
+						commitResult(output, result, checked);
 					}
 				}
 			}
 		}
 	} else {
-		rawImage = cv::imread(imageName.c_str(), cv::IMREAD_GRAYSCALE);
-		if (rawImage.empty()) {
+		auto scanned = scanImageFile(context, imageName, pageSize, qrBox, shapes);
+		if (scanned == nullptr) {
 			cout << "Could not open or find the rawImage" << std::endl;
 			return -1;
 		}
 
-		auto results = scanImage(scanner, rawImage, pageSize, qrBox, shapes);
+		auto& results = *scanned;
 
 		for (auto&& result : results) {
+			auto checked = checkResult(output, result);
 			imshow(windowName, result.preview);
 			if (cv::waitKey(0) == KEY_A) {
-				printResult(result.values);
+				commitResult(output, result, checked);
 			}
 		}
 
+		reportTimings(options.timingsFile);
+		if (tracingEnabled) {
+			writeTrace(options.traceFile);
+		}
 		return results.size() > 0 ? 0 : -1;
 	}
 
+	reportTimings(options.timingsFile);
+	if (tracingEnabled) {
+		writeTrace(options.traceFile);
+	}
 	return 0;
 }
@@ -0,0 +1,409 @@
+#include "server.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#ifndef _WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "trace.h"
+
+using namespace std;
+
+#ifdef _WIN32
+
+int runServer(const string& address, const ScanTemplate& sheet, OutputFormat format,
+		const ResultHandler& handler) {
+	cerr << "Error: --serve is not supported on Windows" << endl;
+	return -1;
+}
+
+#else
+
+// Largest encoded image a client may send, well above a 600 DPI letter page.
+const size_t MAX_IMAGE_BYTES = 64 << 20;
+
+// Longest request line, enough for any image path.
+const size_t MAX_REQUEST_LINE = 4096;
+
+// Scan contexts shared by all clients, so a new connection starts with warm buffers.
+class ContextPool {
+public:
+	explicit ContextPool(const ScanTemplate& sheet) : sheet { sheet } { }
+
+	unique_ptr<ScanContext> take() {
+		{
+			lock_guard<mutex> lock(idleMutex);
+			if (!idle.empty()) {
+				auto context = move(idle.back());
+				idle.pop_back();
+				return context;
+			}
+		}
+		unique_ptr<ScanContext> context(new ScanContext());
+		context->settings = sheet.Settings;
+		context->groups = sheet.Groups;
+		return context;
+	}
+
+	void give(unique_ptr<ScanContext> context) {
+		lock_guard<mutex> lock(idleMutex);
+		idle.push_back(move(context));
+	}
+
+private:
+	const ScanTemplate& sheet;
+	mutex idleMutex;
+	vector<unique_ptr<ScanContext>> idle;
+};
+
+// Buffered reads of request lines and image bytes from a client socket.
+class RequestReader {
+public:
+	explicit RequestReader(int socket) : socket { socket } { }
+
+	// Read the next line, failing if the client hangs up or sends a line that is too long.
+	bool readLine(string& outLine) {
+		for (;;) {
+			size_t end = buffer.find('\n', start);
+			if (end != string::npos && end - start <= MAX_REQUEST_LINE) {
+				outLine.assign(buffer, start, end - start);
+				start = end + 1;
+				return true;
+			}
+			if (end != string::npos || buffer.size() - start > MAX_REQUEST_LINE) {
+				tooLong = true;
+				return false;
+			}
+			if (!fill()) {
+				return false;
+			}
+		}
+	}
+
+	bool readBytes(size_t length, vector<uchar>& outBytes) {
+		outBytes.resize(length);
+		size_t copied = min(length, buffer.size() - start);
+		copy(buffer.begin() + start, buffer.begin() + start + copied, outBytes.begin());
+		start += copied;
+		while (copied < length) {
+			ssize_t received = recv(socket, outBytes.data() + copied, length - copied, 0);
+			if (received <= 0) {
+				closed = true;
+				return false;
+			}
+			copied += received;
+		}
+		return true;
+	}
+
+	// Whether the client has hung up.
+	bool isClosed() const { return closed; }
+
+	// Whether the last line wasn't read because it was too long.
+	bool isTooLong() const { return tooLong; }
+
+private:
+	bool fill() {
+		buffer.erase(0, start);
+		start = 0;
+		char chunk[4096];
+		ssize_t received = recv(socket, chunk, sizeof(chunk), 0);
+		if (received <= 0) {
+			closed = true;
+			return false;
+		}
+		buffer.append(chunk, received);
+		return true;
+	}
+
+	int socket;
+	string buffer;
+	size_t start = 0;
+	bool closed = false;
+	bool tooLong = false;
+};
+
+// Read the encoded image of one request, or say why there is none.
+static bool readImage(RequestReader& reader, const string& request, vector<uchar>& outBytes,
+		string& outError) {
+	if (request.compare(0, 5, "path ") == 0) {
+		string path = request.substr(5);
+		if (!readFileBytes(path, outBytes)) {
+			outError = "Could not read " + path;
+			return false;
+		}
+		return true;
+	}
+
+	if (request.compare(0, 6, "image ") == 0) {
+		char* end = nullptr;
+		unsigned long long length = strtoull(request.c_str() + 6, &end, 10);
+		if (end == request.c_str() + 6 || *end != '\0' || length > MAX_IMAGE_BYTES) {
+			outError = "Invalid image length";
+			return false;
+		}
+		if (!reader.readBytes(static_cast<size_t>(length), outBytes)) {
+			outError = "Image truncated";
+			return false;
+		}
+		return true;
+	}
+
+	outError = "Unknown request";
+	return false;
+}
+
+// A connected client. The server closes the socket once the client's thread is done,
+// so it can still shut the socket down while the thread runs.
+struct Client {
+	int Socket;
+	thread Thread;
+	atomic<bool> Done { false };
+};
+
+static void serveClient(Client& client, int number, const ScanTemplate& sheet, OutputFormat format,
+		ContextPool& contexts, const ResultHandler& handler) {
+	setTraceThreadName("client " + to_string(number));
+	int socket = client.Socket;
+
+	FILE* out = fdopen(dup(socket), "w");
+	if (out == nullptr) {
+		client.Done = true;
+		return;
+	}
+
+	{
+		// Binary output starts with its magic as soon as the client connects.
+		ResultWriter writer(out, format, FlushPolicy::Batch);
+		writer.flush();
+
+		RequestReader reader(socket);
+		string request;
+		vector<uchar> bytes;
+		vector<ScanResult> cached;
+		string error;
+		while (reader.readLine(request)) {
+			if (!request.empty() && request.back() == '\r') {
+				request.pop_back();
+			}
+
+			if (!readImage(reader, request, bytes, error)) {
+				fprintf(out, "error %s\n", error.c_str());
+				fflush(out);
+				if (reader.isClosed()) {
+					break;
+				}
+				continue;
+			}
+
+			// OpenCV reports errors in images it can decode but not process with exceptions.
+			// One bad image must not take down the other clients, so it's answered with an
+			// error and its context, which may be left half updated, is dropped.
+			auto context = contexts.take();
+			vector<ScanResult>* results;
+			try {
+				results = scanEncoded(*context, sheet.Cache, bytes, sheet.PageSize, sheet.QRBox,
+						*sheet.Shapes, cached);
+			} catch (const exception& e) {
+				fprintf(out, "error Could not scan image: %s\n", e.what());
+				fflush(out);
+				continue;
+			}
+
+			if (results == nullptr) {
+				fprintf(out, "error Could not decode image\n");
+				fflush(out);
+			} else {
+				fprintf(out, "ok %zu\n", results->size());
+				try {
+					handler(writer, *results);
+				} catch (const exception& e) {
+					// The response is already partly written, so the client can't be answered.
+					cerr << "Error: Could not write results for client " << number << ": "
+							<< e.what() << endl;
+					break;
+				}
+				writer.flush();
+			}
+			contexts.give(move(context));
+
+			if (ferror(out)) {
+				break; // The client hung up.
+			}
+		}
+		if (reader.isTooLong()) {
+			// The rest of the line can't be told apart from the next request.
+			fprintf(out, "error Request too long\n");
+		}
+	}
+
+	fclose(out);
+	shutdown(socket, SHUT_RDWR); // Closed by the server, but the client sees the end now.
+	client.Done = true;
+}
+
+// Open the listening socket, a Unix domain socket or a TCP port on loopback.
+static int listenOn(const string& address) {
+	int listener;
+	if (address.compare(0, 4, "tcp:") == 0) {
+		int port = atoi(address.c_str() + 4);
+		if (port <= 0 || port > 65535) {
+			cerr << "Error: Invalid port in " << address << endl;
+			return -1;
+		}
+
+		listener = socket(AF_INET, SOCK_STREAM, 0);
+		int reuse = 1;
+		if (listener >= 0) {
+			setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		}
+
+		sockaddr_in local { };
+		local.sin_family = AF_INET;
+		local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		local.sin_port = htons(static_cast<uint16_t>(port));
+		if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0) {
+			cerr << "Error: Could not listen on " << address << endl;
+			return -1;
+		}
+	} else {
+		sockaddr_un local { };
+		local.sun_family = AF_UNIX;
+		if (address.empty() || address.size() >= sizeof(local.sun_path)) {
+			cerr << "Error: Invalid socket path " << address << endl;
+			return -1;
+		}
+		address.copy(local.sun_path, address.size());
+
+		// Replace the socket of a previous run, but never a file that isn't a socket.
+		struct stat status;
+		if (lstat(address.c_str(), &status) == 0) {
+			if (!S_ISSOCK(status.st_mode)) {
+				cerr << "Error: " << address << " exists and is not a socket" << endl;
+				return -1;
+			}
+			unlink(address.c_str());
+		}
+		listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0) {
+			cerr << "Error: Could not listen on " << address << endl;
+			return -1;
+		}
+	}
+
+	if (listen(listener, SOMAXCONN) != 0) {
+		cerr << "Error: Could not listen on " << address << endl;
+		close(listener);
+		return -1;
+	}
+	return listener;
+}
+
+// Written to by the signal handler to wake the accept loop.
+static int stopPipe[2] = { -1, -1 };
+
+static void requestStop(int) {
+	char stop = 1;
+	ssize_t written = write(stopPipe[1], &stop, 1);
+	(void)written;
+}
+
+// Join the threads of clients that hung up and close their sockets.
+static void reapClients(list<Client>& clients, bool all) {
+	for (auto client = clients.begin(); client != clients.end();) {
+		if (all || client->Done) {
+			client->Thread.join();
+			close(client->Socket);
+			client = clients.erase(client);
+		} else {
+			++client;
+		}
+	}
+}
+
+int runServer(const string& address, const ScanTemplate& sheet, OutputFormat format,
+		const ResultHandler& handler) {
+	// A client hanging up mid-response shouldn't take the server down.
+	signal(SIGPIPE, SIG_IGN);
+
+	int listener = listenOn(address);
+	if (listener < 0) {
+		return -1;
+	}
+	if (pipe(stopPipe) != 0) {
+		cerr << "Error: Could not listen on " << address << endl;
+		close(listener);
+		return -1;
+	}
+	fcntl(stopPipe[1], F_SETFL, O_NONBLOCK);
+	signal(SIGINT, requestStop);
+	signal(SIGTERM, requestStop);
+	cerr << "Serving " << address << endl;
+
+	ContextPool contexts(sheet);
+	list<Client> clients;
+	bool tcp = address.compare(0, 4, "tcp:") == 0;
+	for (int number = 1; ; ) {
+		pollfd events[2] = { { listener, POLLIN, 0 }, { stopPipe[0], POLLIN, 0 } };
+		if (poll(events, 2, -1) < 0) {
+			continue; // Interrupted by a signal, the stop pipe says which.
+		}
+		if (events[1].revents != 0) {
+			break;
+		}
+
+		int socket = accept(listener, nullptr, nullptr);
+		if (socket < 0) {
+			continue;
+		}
+		if (tcp) {
+			// Responses are small, send them as soon as they're flushed.
+			int noDelay = 1;
+			setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+		}
+
+		reapClients(clients, false);
+		clients.emplace_back();
+		auto& client = clients.back();
+		client.Socket = socket;
+		client.Thread = thread(serveClient, ref(client), number++, cref(sheet), format,
+				ref(contexts), cref(handler));
+	}
+
+	// Let every client finish the request it is on, but read no further requests.
+	cerr << "Stopping, waiting for " << clients.size() << " clients" << endl;
+	close(listener);
+	struct stat status;
+	if (!tcp && lstat(address.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+		unlink(address.c_str());
+	}
+	for (auto&& client : clients) {
+		shutdown(client.Socket, SHUT_RD);
+	}
+	reapClients(clients, true);
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	close(stopPipe[0]);
+	close(stopPipe[1]);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "output.h"
+#include "resultcache.h"
+#include "scanner.h"
+#include "sheet.h"
+
+// The sheet template every request is scanned against.
+struct ScanTemplate {
+	const std::map<std::string, SVGShape>* Shapes;
+	cv::Size PageSize;
+	cv::Rect2f QRBox;
+	ScanSettings Settings;
+	const std::vector<BubbleGroup>* Groups; // Decided after sampling if set.
+	ResultCache* Cache; // Images answered without scanning them again, if set.
+};
+
+// Writes the results of one request to the client. Called from the client's thread,
+// so it must be safe to call from several threads at once.
+typedef std::function<void(ResultWriter& writer, std::vector<ScanResult>& results)> ResultHandler;
+
+// Serve scans to local clients, keeping the template, scan contexts and their buffers
+// warm between requests. The address is a Unix domain socket path, or "tcp:Port" to
+// listen on the loopback interface instead. Each client gets a thread of its own and
+// may pipeline requests, which are answered in order. A request is a line, either
+//   path ImageFile          Scan an image file readable by the server.
+//   image Length            Scan the encoded image (PNG, JPEG, ...) in the Length
+//                           bytes that follow the line.
+// and is answered with "ok Forms" and the results of each form in the output format,
+// or with "error Message". Binary output starts with its magic when the client
+// connects. On SIGINT or SIGTERM the server stops accepting clients, finishes the
+// requests in progress and returns 0. Returns -1 if the server can't be started.
+int runServer(const std::string& address, const ScanTemplate& sheet, OutputFormat format,
+		const ResultHandler& handler);
+
+#endif
@@ -0,0 +1,120 @@
+#include "sheet.h"
+
+#include <climits>
+
+#include <opencv2/imgproc.hpp>
+
+using namespace std;
+
+SVGShape::SVGShape(NSVGshape* shape) :
+	Id { shape->id },
+	BoundingBox {
+		shape->bounds[0],
+		shape->bounds[1],
+		shape->bounds[2] - shape->bounds[0],
+		shape->bounds[3] - shape->bounds[1] }
+{
+	for (auto path = shape->paths; path != nullptr; path = path->next) {
+		for (auto i = 0; i < path->npts; i++) {
+			Outline.push_back(
+					cv::Point2f(path->pts[i * 2], path->pts[i * 2 + 1]));
+		}
+	}
+
+	if (!Outline.empty()) {
+		// Draw the outline the way it used to be sampled and record its runs.
+		cv::Rect bounds = cv::boundingRect(Outline);
+		PixelBounds = bounds;
+		cv::Mat mask = cv::Mat::zeros(bounds.size(), CV_8UC1);
+		vector<vector<cv::Point>> outlines { Outline };
+		cv::drawContours(mask, outlines, 0, 255, -1, cv::LINE_8, cv::noArray(), INT_MAX, -bounds.tl());
+
+		for (int y = 0; y < mask.rows; y++) {
+			const uchar* row = mask.ptr<uchar>(y);
+			for (int x = 0; x < mask.cols; x++) {
+				if (row[x] == 0) {
+					continue;
+				}
+				int start = x;
+				while (x < mask.cols && row[x] != 0) {
+					x++;
+				}
+				Spans.push_back(PixelSpan { bounds.y + y, bounds.x + start, bounds.x + x });
+			}
+		}
+	}
+}
+
+map<string, SVGShape> findSVGShapes(const string filename, cv::Size& outPageSize) {
+	map<string, SVGShape> shapes;
+	NSVGimage* image = nullptr;
+
+	image = nsvgParseFromFile(filename.c_str(), "px", 150.0f);
+	if (image == nullptr) {
+		return {};
+	}
+
+	outPageSize = {static_cast<int>(image->width), static_cast<int>(image->height)};
+
+	for (auto shape = image->shapes; shape != nullptr; shape = shape->next) {
+		shapes[shape->id] = SVGShape(shape);
+	}
+
+	nsvgDelete(image);
+
+	return shapes;
+}
+
+bool isBubbleId(const string& id) {
+	auto dot = id.find('.');
+	return dot != string::npos && dot != 0 && dot + 1 != id.size();
+}
+
+void omitLayoutShapes(map<string, SVGShape>& shapes) {
+	for (auto shape = shapes.begin(); shape != shapes.end();) {
+		if (isBubbleId(shape->first)) {
+			++shape;
+		} else {
+			shape = shapes.erase(shape);
+		}
+	}
+}
+
+vector<string> shapeIds(const map<string, SVGShape>& shapes) {
+	vector<string> ids;
+	for (auto&& shape : shapes) {
+		ids.push_back(shape.first);
+	}
+	return ids;
+}
+
+vector<BubbleGroup> compileBubbleGroups(const map<string, SVGShape>& shapes) {
+	vector<BubbleGroup> groups;
+	map<string, size_t> groupIndex;
+	size_t ordinal = 0;
+
+	for (auto&& shape : shapes) {
+		size_t shapeOrdinal = ordinal++;
+		if (!isBubbleId(shape.first)) {
+			continue;
+		}
+		auto dot = shape.first.find('.');
+
+		string name = shape.first.substr(0, dot);
+		auto found = groupIndex.find(name);
+		if (found == groupIndex.end()) {
+			found = groupIndex.emplace(name, groups.size()).first;
+			groups.push_back(BubbleGroup { name, { }, { }, { }, shapeOrdinal, true });
+		}
+
+		auto& group = groups[found->second];
+		group.Options.push_back(shape.first.substr(dot + 1));
+		group.ShapeIds.push_back(shape.first);
+		group.Ordinals.push_back(shapeOrdinal);
+
+		auto& option = group.Options.back();
+		group.Digits = group.Digits && option.size() == 1 && option[0] >= '0' && option[0] <= '9';
+	}
+
+	return groups;
+}
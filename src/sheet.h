@@ -0,0 +1,59 @@
+#ifndef SHEET_H
+#define SHEET_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "bitpage.h"
+#include "nanosvg.h"
+
+struct SVGShape {
+	SVGShape() = default;
+	SVGShape(NSVGshape* shape);
+
+	std::string Id;
+	std::vector<cv::Point> Outline;
+	cv::Rect2f BoundingBox;
+
+	// Rows of the filled outline, so sampling doesn't draw a mask.
+	std::vector<PixelSpan> Spans;
+	cv::Rect PixelBounds; // Bounds of the spans.
+};
+
+// Find all the shapes in an SVG file.
+// Output is a map of SVG ID to shape
+std::map<std::string, SVGShape> findSVGShapes(const std::string filename, cv::Size& outPageSize);
+
+// Bubbles have ids of the form "group.option". Other shapes, like the page border
+// and the QR code placeholder, only lay out the sheet.
+bool isBubbleId(const std::string& id);
+
+// Remove the layout shapes, so only bubbles are sampled and written. Read the QR code
+// placeholder first.
+void omitLayoutShapes(std::map<std::string, SVGShape>& shapes);
+
+// Ids of the shapes in map order. A shape's position in this list is its ordinal,
+// which indexes the fills of a ScanResult.
+std::vector<std::string> shapeIds(const std::map<std::string, SVGShape>& shapes);
+
+// A set of mutually exclusive bubbles sharing an SVG id prefix.
+// For example "team1.0" through "team1.9" form the group "team1" with options "0" through "9".
+// Ids sort by group first, so the options of a group have consecutive ordinals and
+// their fills are contiguous starting at First.
+struct BubbleGroup {
+	std::string Name;
+	std::vector<std::string> Options;
+	std::vector<std::string> ShapeIds;
+	std::vector<size_t> Ordinals; // Shape ordinal of each option.
+	size_t First;
+	bool Digits; // Every option is a single digit.
+};
+
+// Group the shapes whose id has the form "group.option".
+// Groups and their options are ordered by SVG id.
+std::vector<BubbleGroup> compileBubbleGroups(const std::map<std::string, SVGShape>& shapes);
+
+#endif
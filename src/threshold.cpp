@@ -0,0 +1,132 @@
+#include "threshold.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+bool parseThresholdSampling(const string& name, ThresholdSampling& outSampling) {
+	if (name == "full") {
+		outSampling = ThresholdSampling::Full;
+	} else if (name == "reduced") {
+		outSampling = ThresholdSampling::Reduced;
+	} else if (name == "bubbles") {
+		outSampling = ThresholdSampling::Bubbles;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool parseLighting(const string& name, Lighting& outLighting) {
+	if (name == "uniform") {
+		outLighting = Lighting::Uniform;
+	} else if (name == "uneven") {
+		outLighting = Lighting::Uneven;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// Sum of the pixels in a rectangle of an integral image.
+static double rectSum(const cv::Mat& integral, cv::Rect rect) {
+	return static_cast<double>(integral.at<int>(rect.y + rect.height, rect.x + rect.width))
+			- integral.at<int>(rect.y, rect.x + rect.width)
+			- integral.at<int>(rect.y + rect.height, rect.x)
+			+ integral.at<int>(rect.y, rect.x);
+}
+
+void accumulateHistogram(const cv::Mat& gray, Histogram& histogram) {
+	uint32_t counts[4][256] = { };
+
+	for (int y = 0; y < gray.rows; y++) {
+		const uchar* row = gray.ptr<uchar>(y);
+		int x = 0;
+		for (; x + 8 <= gray.cols; x += 8) {
+			// Load eight pixels at once and spread them over the sub-histograms.
+			uint64_t pixels;
+			memcpy(&pixels, row + x, sizeof(pixels));
+			counts[0][pixels & 0xff]++;
+			counts[1][(pixels >> 8) & 0xff]++;
+			counts[2][(pixels >> 16) & 0xff]++;
+			counts[3][(pixels >> 24) & 0xff]++;
+			counts[0][(pixels >> 32) & 0xff]++;
+			counts[1][(pixels >> 40) & 0xff]++;
+			counts[2][(pixels >> 48) & 0xff]++;
+			counts[3][pixels >> 56]++;
+		}
+		for (; x < gray.cols; x++) {
+			counts[0][row[x]]++;
+		}
+	}
+
+	for (int i = 0; i < 256; i++) {
+		histogram.Counts[i] += counts[0][i] + counts[1][i] + counts[2][i] + counts[3][i];
+	}
+}
+
+int otsuThreshold(const Histogram& histogram) {
+	const int N = 256;
+	double total = 0, mu = 0;
+	for (int i = 0; i < N; i++) {
+		total += histogram.Counts[i];
+		mu += i * static_cast<double>(histogram.Counts[i]);
+	}
+	if (total == 0) {
+		return 0;
+	}
+	double scale = 1.0 / total;
+	mu *= scale;
+
+	// Maximize the between-class variance.
+	double mu1 = 0, q1 = 0;
+	double maxSigma = 0;
+	int level = 0;
+	for (int i = 0; i < N; i++) {
+		double p = histogram.Counts[i] * scale;
+		mu1 *= q1;
+		q1 += p;
+		double q2 = 1.0 - q1;
+		if (min(q1, q2) < FLT_EPSILON || max(q1, q2) > 1.0 - FLT_EPSILON) {
+			continue;
+		}
+		mu1 = (mu1 + i * p) / q1;
+		double mu2 = (mu - q1 * mu1) / q2;
+		double sigma = q1 * q2 * (mu1 - mu2) * (mu1 - mu2);
+		if (sigma > maxSigma) {
+			maxSigma = sigma;
+			level = i;
+		}
+	}
+	return level;
+}
+
+int localThreshold(const PaperIntegrals& paper, cv::Rect region, int level) {
+	cv::Rect page(0, 0, paper.Sum.cols - 1, paper.Sum.rows - 1);
+	cv::Point center(region.x + region.width / 2, region.y + region.height / 2);
+	cv::Rect window = cv::Rect(center.x - LOCAL_WINDOW / 2, center.y - LOCAL_WINDOW / 2,
+			LOCAL_WINDOW, LOCAL_WINDOW) & page;
+
+	// Too little paper in a window crowded with bubbles says little about the lighting.
+	double pageArea = rectSum(paper.Area, page);
+	double localArea = window.area() > 0 ? rectSum(paper.Area, window) : 0;
+	if (pageArea <= 0 || localArea < window.area() / 8) {
+		return level;
+	}
+
+	double pageMean = rectSum(paper.Sum, page) / pageArea;
+	double localMean = rectSum(paper.Sum, window) / localArea;
+	if (pageMean <= 0) {
+		return level;
+	}
+	return min(255, max(0, static_cast<int>(lround(level * localMean / pageMean))));
+}
+
+int otsuThreshold(const cv::Mat& gray) {
+	Histogram histogram;
+	accumulateHistogram(gray, histogram);
+	return otsuThreshold(histogram);
+}
@@ -0,0 +1,55 @@
+#ifndef THRESHOLD_H
+#define THRESHOLD_H
+
+#include <cstdint>
+#include <string>
+
+#include <opencv2/core/core.hpp>
+
+// Which pixels the global Otsu level is computed from.
+enum class ThresholdSampling {
+	Full,    // Every pixel of the blurred page, as cv::threshold does. The reference.
+	Reduced, // A quarter resolution copy of the page, blurred to match.
+	Bubbles  // The blurred pixels around the bubbles only.
+};
+
+bool parseThresholdSampling(const std::string& name, ThresholdSampling& outSampling);
+
+enum class Lighting {
+	Uniform, // Scanned sheets: one global level for the page.
+	Uneven   // Camera shots: the level follows the local brightness around each bubble.
+};
+
+bool parseLighting(const std::string& name, Lighting& outLighting);
+
+// Side of the square around a bubble whose brightness sets its local level.
+const int LOCAL_WINDOW = 96;
+
+// Levels selected by sampling should stay this close to the full Otsu level.
+const int THRESHOLD_TOLERANCE = 3;
+
+struct Histogram {
+	uint32_t Counts[256] = { };
+};
+
+// Add the pixels of an 8-bit image. Four interleaved sub-histograms are used so that
+// consecutive equal pixels don't stall on the same counter.
+void accumulateHistogram(const cv::Mat& gray, Histogram& histogram);
+
+// Otsu's threshold, computed exactly like cv::threshold with THRESH_OTSU does.
+int otsuThreshold(const Histogram& histogram);
+int otsuThreshold(const cv::Mat& gray);
+
+// Integral images of the paper of a page, leaving out the bubbles so that a filled
+// bubble doesn't darken its own surroundings.
+struct PaperIntegrals {
+	cv::Mat Sum;  // CV_32S integral of the page with the bubbles zeroed.
+	cv::Mat Area; // CV_32S integral of a mask that is 1 outside the bubbles.
+};
+
+// Scale the global level by how bright the paper is around a region compared to the
+// paper of the whole page, so that a bubble in a shadow is judged against the paper
+// next to it.
+int localThreshold(const PaperIntegrals& paper, cv::Rect region, int level);
+
+#endif
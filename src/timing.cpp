@@ -0,0 +1,147 @@
+#include "timing.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+bool timingsEnabled = false;
+
+static LatencyHistogram histograms[static_cast<int>(Stage::Count)];
+
+const char* stageName(Stage stage) {
+	switch (stage) {
+	case Stage::ImageLoad: return "image_load";
+	case Stage::QRScan: return "qr_scan";
+	case Stage::PageWarp: return "page_warp";
+	case Stage::PageEdges: return "page_edges";
+	case Stage::PageContours: return "page_contours";
+	case Stage::PageFinalWarp: return "page_final_warp";
+	case Stage::Threshold: return "threshold";
+	case Stage::Sampling: return "sampling";
+	case Stage::Output: return "output";
+	case Stage::Sheet: return "sheet";
+	case Stage::Count: break;
+	}
+	return "unknown";
+}
+
+LatencyHistogram& stageHistogram(Stage stage) {
+	return histograms[static_cast<int>(stage)];
+}
+
+static int bucketOf(uint64_t value) {
+	const uint64_t subBuckets = uint64_t(1) << LatencyHistogram::SUB_BITS;
+	if (value < subBuckets) {
+		return static_cast<int>(value);
+	}
+
+	int msb = 0;
+	while ((value >> msb) > 1) {
+		msb++;
+	}
+	int shift = msb - LatencyHistogram::SUB_BITS;
+	auto sub = (value >> shift) - subBuckets;
+	return static_cast<int>(((shift + 1) << LatencyHistogram::SUB_BITS) + sub);
+}
+
+// Midpoint of the values that fall in a bucket.
+static uint64_t valueOf(int bucket) {
+	const int subBuckets = 1 << LatencyHistogram::SUB_BITS;
+	if (bucket < subBuckets) {
+		return bucket;
+	}
+
+	int shift = bucket / subBuckets - 1;
+	uint64_t lowest = static_cast<uint64_t>(subBuckets + bucket % subBuckets) << shift;
+	return lowest + (uint64_t(1) << shift) / 2;
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds) {
+	buckets[bucketOf(nanoseconds)].fetch_add(1, memory_order_relaxed);
+	total.fetch_add(1, memory_order_relaxed);
+
+	auto current = maximum.load(memory_order_relaxed);
+	while (nanoseconds > current
+			&& !maximum.compare_exchange_weak(current, nanoseconds, memory_order_relaxed)) {
+	}
+}
+
+uint64_t LatencyHistogram::percentile(double fraction) const {
+	auto target = static_cast<uint64_t>(fraction * count() + 0.5);
+	uint64_t seen = 0;
+	for (int i = 0; i < BUCKETS; i++) {
+		seen += buckets[i].load(memory_order_relaxed);
+		if (seen >= target && seen > 0) {
+			return min(valueOf(i), max());
+		}
+	}
+	return max();
+}
+
+static double toMilliseconds(uint64_t nanoseconds) {
+	return nanoseconds / 1e6;
+}
+
+void printTimings(ostream& out) {
+	char line[128];
+	snprintf(line, sizeof(line), "%-16s %8s %10s %10s %10s %10s\n",
+			"stage", "count", "p50 ms", "p95 ms", "p99 ms", "max ms");
+	out << line;
+
+	for (int i = 0; i < static_cast<int>(Stage::Count); i++) {
+		auto& histogram = histograms[i];
+		if (histogram.count() == 0) {
+			continue;
+		}
+		snprintf(line, sizeof(line), "%-16s %8llu %10.3f %10.3f %10.3f %10.3f\n",
+				stageName(static_cast<Stage>(i)),
+				static_cast<unsigned long long>(histogram.count()),
+				toMilliseconds(histogram.percentile(0.50)),
+				toMilliseconds(histogram.percentile(0.95)),
+				toMilliseconds(histogram.percentile(0.99)),
+				toMilliseconds(histogram.max()));
+		out << line;
+	}
+}
+
+void writeTimingsJson(ostream& out) {
+	out << "{";
+	bool first = true;
+	for (int i = 0; i < static_cast<int>(Stage::Count); i++) {
+		auto& histogram = histograms[i];
+		if (histogram.count() == 0) {
+			continue;
+		}
+		if (!first) {
+			out << ",";
+		}
+		first = false;
+		out << "\"" << stageName(static_cast<Stage>(i)) << "\":{"
+			<< "\"count\":" << histogram.count()
+			<< ",\"p50_ns\":" << histogram.percentile(0.50)
+			<< ",\"p95_ns\":" << histogram.percentile(0.95)
+			<< ",\"p99_ns\":" << histogram.percentile(0.99)
+			<< ",\"max_ns\":" << histogram.max() << "}";
+	}
+	out << "}" << endl;
+}
+
+void reportTimings(const string& destination) {
+	if (!timingsEnabled) {
+		return;
+	}
+
+	if (destination == "-") {
+		printTimings(cerr);
+		return;
+	}
+
+	ofstream out(destination);
+	if (!out) {
+		cerr << "Error: Could not write " << destination << endl;
+		return;
+	}
+	writeTimingsJson(out);
+}
@@ -0,0 +1,106 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "trace.h"
+
+// Pipeline stages that are timed.
+enum class Stage {
+	ImageLoad,
+	QRScan,
+	PageWarp,      // tryFindPage: warp around the QR code
+	PageEdges,     // tryFindPage: blur and Canny
+	PageContours,  // tryFindPage: find and sort contours, find the page corners
+	PageFinalWarp, // tryFindPage: warp to the page corners
+	Threshold,     // Blur and Otsu threshold
+	Sampling,      // Bubble fill sampling
+	Output,
+	Sheet,         // Everything for one form, from QR code to sampled bubbles
+	Count
+};
+
+const char* stageName(Stage stage);
+
+// A log-linear histogram of latencies in nanoseconds, in the style of HdrHistogram.
+// Each power of two is split into 32 linear buckets, so recorded values are accurate
+// to about 3%. Recording is a relaxed atomic increment, so it's safe from any thread.
+class LatencyHistogram {
+public:
+	static const int SUB_BITS = 5;
+	static const int BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+	void record(uint64_t nanoseconds);
+
+	uint64_t count() const { return total.load(std::memory_order_relaxed); }
+	uint64_t max() const { return maximum.load(std::memory_order_relaxed); }
+
+	// Value at or below which the given fraction of the recorded values fall.
+	uint64_t percentile(double fraction) const;
+
+private:
+	std::atomic<uint64_t> buckets[BUCKETS] { };
+	std::atomic<uint64_t> total { 0 };
+	std::atomic<uint64_t> maximum { 0 };
+};
+
+// Set by --timings. Timers do nothing unless it is set.
+extern bool timingsEnabled;
+
+LatencyHistogram& stageHistogram(Stage stage);
+
+// Print count, p50, p95, p99 and max of every stage that ran.
+void printTimings(std::ostream& out);
+void writeTimingsJson(std::ostream& out);
+
+// Print the timings to stderr if the destination is "-", otherwise write them as JSON
+// to the named file. Does nothing if timings are disabled.
+void reportTimings(const std::string& destination);
+
+// Times the enclosing scope, or until stop() is called, for the stage histograms
+// and the trace.
+class StageTimer {
+public:
+	explicit StageTimer(Stage stage) :
+		stage { stage }, running { timingsEnabled || tracingEnabled }
+	{
+		if (running) {
+			if (tracingEnabled && stage == Stage::Sheet) {
+				beginTraceSheet();
+			}
+			start = std::chrono::steady_clock::now();
+		}
+	}
+
+	~StageTimer() {
+		stop();
+	}
+
+	StageTimer(const StageTimer&) = delete;
+	StageTimer& operator=(const StageTimer&) = delete;
+
+	void stop() {
+		if (running) {
+			running = false;
+			auto end = std::chrono::steady_clock::now();
+			if (timingsEnabled) {
+				stageHistogram(stage).record(static_cast<uint64_t>(
+						std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+			}
+			if (tracingEnabled) {
+				traceStage(stage, start, end);
+			}
+		}
+	}
+
+private:
+	Stage stage;
+	bool running;
+	std::chrono::steady_clock::time_point start;
+};
+
+#endif
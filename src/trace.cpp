@@ -0,0 +1,109 @@
+#include "trace.h"
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "timing.h"
+
+using namespace std;
+
+bool tracingEnabled = false;
+
+struct TraceEvent {
+	Stage stage;
+	long sheet;
+	chrono::steady_clock::time_point start;
+	chrono::steady_clock::time_point end;
+};
+
+struct ThreadTrace {
+	int id;
+	string name;
+	long sheet = 0;
+	vector<TraceEvent> events;
+};
+
+// Thread buffers are owned here so they outlive their threads.
+static mutex threadsMutex;
+static vector<unique_ptr<ThreadTrace>> threads;
+static atomic<long> sheetCount { 0 };
+static const auto traceStart = chrono::steady_clock::now();
+
+static ThreadTrace& threadTrace() {
+	thread_local ThreadTrace* trace = nullptr;
+	if (trace == nullptr) {
+		lock_guard<mutex> lock(threadsMutex);
+		threads.emplace_back(new ThreadTrace());
+		trace = threads.back().get();
+		trace->id = static_cast<int>(threads.size());
+		trace->name = trace->id == 1 ? "main" : "thread " + to_string(trace->id);
+		trace->events.reserve(4096);
+	}
+	return *trace;
+}
+
+void traceStage(Stage stage, chrono::steady_clock::time_point start,
+		chrono::steady_clock::time_point end) {
+	auto& trace = threadTrace();
+	trace.events.push_back(TraceEvent { stage, trace.sheet, start, end });
+}
+
+void beginTraceSheet() {
+	threadTrace().sheet = ++sheetCount;
+}
+
+void setTraceThreadName(const string& name) {
+	if (tracingEnabled) {
+		threadTrace().name = name;
+	}
+}
+
+static double toMicroseconds(chrono::steady_clock::time_point time) {
+	return chrono::duration<double, micro>(time - traceStart).count();
+}
+
+bool writeTrace(const string& filename) {
+	ofstream out(filename);
+	if (!out) {
+		cerr << "Error: Could not write " << filename << endl;
+		return false;
+	}
+
+	lock_guard<mutex> lock(threadsMutex);
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+	bool first = true;
+	auto separator = [&]() {
+		out << (first ? "\n" : ",\n");
+		first = false;
+	};
+
+	char number[32];
+	for (auto&& thread : threads) {
+		separator();
+		out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << thread->id
+			<< ",\"args\":{\"name\":\"" << thread->name << "\"}}";
+
+		for (auto&& event : thread->events) {
+			separator();
+			out << "{\"ph\":\"X\",\"name\":\"" << stageName(event.stage)
+				<< "\",\"pid\":1,\"tid\":" << thread->id;
+			snprintf(number, sizeof(number), "%.3f", toMicroseconds(event.start));
+			out << ",\"ts\":" << number;
+			snprintf(number, sizeof(number), "%.3f",
+					chrono::duration<double, micro>(event.end - event.start).count());
+			out << ",\"dur\":" << number;
+			if (event.sheet > 0) {
+				out << ",\"args\":{\"sheet\":" << event.sheet << "}";
+			}
+			out << "}";
+		}
+	}
+
+	out << "\n]}" << endl;
+	return static_cast<bool>(out);
+}
@@ -0,0 +1,27 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <string>
+
+enum class Stage;
+
+// Set by --trace. Stage timers record trace events only if it is set.
+extern bool tracingEnabled;
+
+// Record a stage on the calling thread's timeline. Each thread appends to its own
+// buffer, so recording takes no locks once a thread has recorded its first event.
+void traceStage(Stage stage, std::chrono::steady_clock::time_point start,
+		std::chrono::steady_clock::time_point end);
+
+// Start a new sheet on the calling thread. Events until the next call are tagged with it.
+void beginTraceSheet();
+
+// Name the calling thread on the timeline, e.g. "worker 2".
+void setTraceThreadName(const std::string& name);
+
+// Write all recorded events in the Chrome trace event format, which chrome://tracing
+// and Perfetto can open. Call once the worker threads have finished.
+bool writeTrace(const std::string& filename);
+
+#endif
@@ -0,0 +1,198 @@
+#include "validate.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+void NumberSet::insert(long value) {
+	if (value < 0) {
+		return;
+	}
+	size_t word = static_cast<size_t>(value) / 64;
+	if (word >= bits.size()) {
+		bits.resize(word + 1);
+	}
+	bits[word] |= uint64_t(1) << (value % 64);
+}
+
+static bool parseNumber(const string& text, long& outValue) {
+	if (text.empty()) {
+		return false;
+	}
+	char* end = nullptr;
+	outValue = strtol(text.c_str(), &end, 10);
+	return *end == '\0';
+}
+
+static bool loadNumberSet(const string filename, NumberSet& outSet) {
+	ifstream file(filename);
+	if (!file) {
+		cerr << "Error: Could not open " << filename << endl;
+		return false;
+	}
+
+	string line;
+	long value;
+	while (getline(file, line)) {
+		if (parseNumber(line, value)) {
+			outSet.insert(value);
+		}
+	}
+	return true;
+}
+
+bool loadRules(const string filename, const FieldSchema& schema, RuleProgram& outProgram) {
+	ifstream file(filename);
+	if (!file) {
+		cerr << "Error: Could not open " << filename << endl;
+		return false;
+	}
+
+	auto directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+	RuleProgram program;
+	string line;
+	int lineNumber = 0;
+
+	while (getline(file, line)) {
+		lineNumber++;
+		auto colon = line.find(':');
+		istringstream tokens(line.substr(0, colon));
+		string keyword, op;
+		if (!(tokens >> keyword) || keyword != "check") {
+			continue;
+		}
+		tokens >> op;
+
+		auto fail = [&](const string& error) {
+			cerr << "Error: " << filename << ":" << lineNumber << ": " << error << endl;
+			return false;
+		};
+
+		Rule rule { RuleOp::Member, static_cast<uint16_t>(program.Operands.size()), 0, 0, 0, 0, "" };
+		if (colon == string::npos) {
+			return fail("missing ': message'");
+		}
+		auto message = line.find_first_not_of(" \t", colon + 1);
+		rule.Message = message == string::npos ? "" : line.substr(message);
+
+		// Split the arguments into field names and numbers.
+		vector<string> arguments;
+		string argument;
+		while (tokens >> argument) {
+			arguments.push_back(argument);
+		}
+
+		auto addField = [&](const string& name) {
+			for (size_t i = 0; i < schema.Fields.size(); i++) {
+				if (schema.Fields[i].Name == name) {
+					program.Operands.push_back(static_cast<long>(i));
+					return true;
+				}
+			}
+			return fail("no field named " + name);
+		};
+
+		if (op == "member" && arguments.size() == 2) {
+			rule.Op = RuleOp::Member;
+			rule.Set = static_cast<uint16_t>(program.Sets.size());
+			program.Sets.emplace_back();
+			if (!addField(arguments[0]) || !loadNumberSet(directory + arguments[1], program.Sets.back())) {
+				return false;
+			}
+		} else if (op == "range" && arguments.size() >= 3) {
+			rule.Op = RuleOp::Range;
+			if (!addField(arguments[0]) || !parseNumber(arguments[1], rule.Min)
+					|| !parseNumber(arguments[2], rule.Max)) {
+				return fail("expected range field min max [value...]");
+			}
+			for (size_t i = 3; i < arguments.size(); i++) {
+				long value;
+				if (!parseNumber(arguments[i], value)) {
+					return fail("expected a number instead of " + arguments[i]);
+				}
+				program.Operands.push_back(value);
+			}
+		} else if (op == "sum" && arguments.size() >= 3 && arguments[arguments.size() - 2] == "max") {
+			rule.Op = RuleOp::SumMax;
+			if (!parseNumber(arguments.back(), rule.Max)) {
+				return fail("expected a number instead of " + arguments.back());
+			}
+			for (size_t i = 0; i + 2 < arguments.size(); i++) {
+				if (!addField(arguments[i])) {
+					return false;
+				}
+			}
+		} else if (op == "exclusive" && arguments.size() >= 2) {
+			rule.Op = RuleOp::Exclusive;
+			for (auto&& name : arguments) {
+				if (!addField(name)) {
+					return false;
+				}
+			}
+		} else {
+			return fail("unknown check '" + op + "'");
+		}
+
+		rule.Count = static_cast<uint16_t>(program.Operands.size() - rule.First);
+		program.Rules.push_back(rule);
+	}
+
+	outProgram = program;
+	return true;
+}
+
+string validateRecord(const RuleProgram& program, const vector<DecodedField>& record) {
+	string errors;
+
+	for (auto&& rule : program.Rules) {
+		auto operands = &program.Operands[rule.First];
+		bool valid = true;
+		long value = 0;
+
+		switch (rule.Op) {
+		case RuleOp::Member:
+			valid = parseNumber(record[operands[0]].Text, value)
+					&& program.Sets[rule.Set].contains(value);
+			break;
+
+		case RuleOp::Range:
+			valid = parseNumber(record[operands[0]].Text, value);
+			if (valid && (value < rule.Min || value > rule.Max)) {
+				valid = false;
+				for (size_t i = 1; i < rule.Count; i++) {
+					valid = valid || value == operands[i];
+				}
+			}
+			break;
+
+		case RuleOp::SumMax: {
+			long sum = 0;
+			for (size_t i = 0; i < rule.Count && valid; i++) {
+				valid = parseNumber(record[operands[i]].Text, value);
+				sum += value;
+			}
+			valid = valid && sum <= rule.Max;
+			break;
+		}
+
+		case RuleOp::Exclusive: {
+			int marked = 0;
+			for (size_t i = 0; i < rule.Count; i++) {
+				marked += record[operands[i]].Marked ? 1 : 0;
+			}
+			valid = marked <= 1;
+			break;
+		}
+		}
+
+		if (!valid) {
+			errors += rule.Message;
+			errors += '\n';
+		}
+	}
+
+	return errors;
+}
@@ -0,0 +1,61 @@
+#ifndef VALIDATE_H
+#define VALIDATE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "decode.h"
+
+enum class RuleOp {
+	Member,    // The field is a number in a set, e.g. a registered team.
+	Range,     // The field is a number within [min, max] or one of a few extra values.
+	SumMax,    // The fields add up to at most max.
+	Exclusive  // At most one of the fields is marked.
+};
+
+struct Rule {
+	RuleOp Op;
+	uint16_t First;  // First operand in RuleProgram::Operands
+	uint16_t Count;  // Number of operands
+	long Min;
+	long Max;
+	uint16_t Set;    // Index into RuleProgram::Sets for Member rules
+	std::string Message;
+};
+
+// A set of numbers stored as a bitmap.
+class NumberSet {
+public:
+	void insert(long value);
+	bool contains(long value) const {
+		return value >= 0 && static_cast<size_t>(value) < bits.size() * 64
+				&& (bits[value / 64] >> (value % 64) & 1) != 0;
+	}
+
+private:
+	std::vector<uint64_t> bits;
+};
+
+// Validation rules compiled into a flat program over the fields of a schema.
+// Operands are field indices, except for Range rules where the operands after the
+// field are extra allowed values.
+struct RuleProgram {
+	std::vector<Rule> Rules;
+	std::vector<long> Operands;
+	std::vector<NumberSet> Sets;
+};
+
+// Compile the "check" lines of a field schema file:
+//   check member field listfile : message
+//   check range field min max [value...] : message
+//   check sum field... max n : message
+//   check exclusive field... : message
+// List files are one number per line, relative to the schema file.
+bool loadRules(const std::string filename, const FieldSchema& schema, RuleProgram& outProgram);
+
+// Run the program over a decoded record. Returns the messages of the failed rules,
+// each followed by a newline, or an empty string if the record is valid.
+std::string validateRecord(const RuleProgram& program, const std::vector<DecodedField>& record);
+
+#endif
@@ -0,0 +1,90 @@
+#include "workers.h"
+
+#include "trace.h"
+
+using namespace std;
+
+WorkerPool::~WorkerPool() {
+	{
+		lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	started.notify_all();
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
+
+void WorkerPool::runTasks(size_t count, TaskFunction function, void* data) {
+	if (count == 0) {
+		return;
+	}
+	if (count == 1) {
+		function(data, 0);
+		return;
+	}
+
+	{
+		unique_lock<std::mutex> lock(mutex);
+		// Worker i runs task i + 1.
+		while (threads.size() + 1 < count) {
+			size_t index = threads.size() + 1;
+			threads.emplace_back(&WorkerPool::work, this, index);
+		}
+		this->function = function;
+		this->data = data;
+		this->count = count;
+		pending = threads.size();
+		generation++;
+	}
+	started.notify_all();
+
+	// The workers use the caller's task and data, so wait for them even if task 0 throws.
+	runTask(0);
+
+	unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [this]() { return pending == 0; });
+	this->function = nullptr;
+	this->data = nullptr;
+	if (failure) {
+		auto thrown = failure;
+		failure = nullptr;
+		rethrow_exception(thrown);
+	}
+}
+
+// Run one task of the current run, keeping its exception for the caller. The function
+// and data only change between runs, while every worker is idle.
+void WorkerPool::runTask(size_t index) {
+	try {
+		function(data, index);
+	} catch (...) {
+		lock_guard<std::mutex> lock(mutex);
+		if (!failure) {
+			failure = current_exception();
+		}
+	}
+}
+
+void WorkerPool::work(size_t index) {
+	setTraceThreadName("form worker " + to_string(index));
+
+	size_t seen = 0;
+	unique_lock<std::mutex> lock(mutex);
+	for (;;) {
+		started.wait(lock, [&]() { return stopping || generation != seen; });
+		if (stopping) {
+			return;
+		}
+		seen = generation;
+
+		if (index < count) {
+			lock.unlock();
+			runTask(index);
+			lock.lock();
+		}
+		if (--pending == 0) {
+			finished.notify_one();
+		}
+	}
+}
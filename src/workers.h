@@ -0,0 +1,52 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs a handful of tasks in parallel, e.g. the forms of one image. Threads are
+// started the first time they are needed and kept for later runs, so scanning in
+// steady state doesn't create threads.
+class WorkerPool {
+public:
+	WorkerPool() = default;
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	// Call task(i) for every i below count and wait for all of them. Task 0 runs on
+	// the calling thread, every other task on a worker of its own. The task is called
+	// through a plain pointer, so unlike std::function running it never allocates.
+	// If tasks throw, the first exception is rethrown once every task has finished.
+	template<class Task>
+	void run(size_t count, Task& task) {
+		runTasks(count, [](void* data, size_t index) { (*static_cast<Task*>(data))(index); }, &task);
+	}
+
+private:
+	typedef void (*TaskFunction)(void* data, size_t index);
+
+	void runTasks(size_t count, TaskFunction function, void* data);
+	void work(size_t index);
+	void runTask(size_t index);
+
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable started;
+	std::condition_variable finished;
+
+	TaskFunction function = nullptr;
+	void* data = nullptr;
+	size_t count = 0;
+	size_t generation = 0; // Bumped on every run so workers wake up once per run.
+	size_t pending = 0;    // Workers that haven't finished the current run.
+	std::exception_ptr failure; // First exception thrown by a task of the current run.
+	bool stopping = false;
+};
+
+#endif
@@ -0,0 +1,444 @@
+#include "workqueue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#else
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#include "bench.h"
+#include "csv.h"
+#include "resultcache.h"
+
+using namespace std;
+
+// A lease not touched for this long belongs to a node that died.
+const int LEASE_SECONDS = 60;
+
+// How often a node touches its lease while it scans.
+const chrono::seconds HEARTBEAT_INTERVAL(10);
+
+// How long a node waits before looking again when other nodes hold every lease.
+const chrono::seconds IDLE_INTERVAL(2);
+
+// An image that can't be read may still be being copied onto the share. A node tries
+// it again after a pause, and gives up after this many attempts.
+const int READ_ATTEMPTS = 5;
+const chrono::seconds READ_RETRY_INTERVAL(10);
+
+static bool makeDirectory(const string& path) {
+#ifdef _WIN32
+	return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+	return mkdir(path.c_str(), 0777) == 0 || errno == EEXIST;
+#endif
+}
+
+static bool fileExists(const string& path) {
+	struct stat status;
+	return stat(path.c_str(), &status) == 0;
+}
+
+// Create a file only if it doesn't exist yet, atomically even on network shares. A file
+// whose contents couldn't be written is removed again.
+static bool createExclusive(const string& path, const string& contents) {
+	FILE* out = fopen(path.c_str(), "wbx");
+	if (out == nullptr) {
+		return false;
+	}
+	bool written = fwrite(contents.data(), 1, contents.size(), out) == contents.size();
+	written = fclose(out) == 0 && written;
+	if (!written) {
+		remove(path.c_str());
+	}
+	return written;
+}
+
+static string readFile(const string& path) {
+	ifstream in(path, ios::binary);
+	return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+static string defaultNodeName() {
+	char host[256] = "node";
+#ifdef _WIN32
+	if (const char* name = getenv("COMPUTERNAME")) {
+		snprintf(host, sizeof(host), "%s", name);
+	}
+	int pid = _getpid();
+#else
+	gethostname(host, sizeof(host) - 1);
+	int pid = getpid();
+#endif
+	return string(host) + "-" + to_string(pid);
+}
+
+// The shared directory's notion of the time. Nodes' clocks may disagree, so lease ages
+// are measured against the modification time the file server gives a file just touched.
+static time_t sharedNow(const string& clockFile) {
+	FILE* out = fopen(clockFile.c_str(), "wb");
+	if (out != nullptr) {
+		fclose(out);
+	}
+	struct stat status;
+	return stat(clockFile.c_str(), &status) == 0 ? status.st_mtime : time(nullptr);
+}
+
+// Touches the lease of the image being scanned until it is released.
+class Heartbeat {
+public:
+	Heartbeat() : thread { &Heartbeat::run, this } { }
+
+	~Heartbeat() {
+		{
+			lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_one();
+		thread.join();
+	}
+
+	void hold(const string& lease) {
+		lock_guard<std::mutex> lock(mutex);
+		this->lease = lease;
+	}
+
+	void release() {
+		lock_guard<std::mutex> lock(mutex);
+		lease.clear();
+	}
+
+private:
+	void run() {
+		unique_lock<std::mutex> lock(mutex);
+		while (!wake.wait_for(lock, HEARTBEAT_INTERVAL, [this]() { return stopping; })) {
+			if (!lease.empty()) {
+				utime(lease.c_str(), nullptr);
+			}
+		}
+	}
+
+	std::mutex mutex;
+	condition_variable wake;
+	string lease;
+	bool stopping = false;
+	std::thread thread;
+};
+
+// Paths of the queue state of one directory.
+struct QueuePaths {
+	explicit QueuePaths(const string& directory) :
+		Root { directory + "/.queue" }, Leases { Root + "/leases/" }, Done { Root + "/done/" },
+		Failed { Root + "/failed/" }, Results { Root + "/results/" }, Clocks { Root + "/clocks/" } { }
+
+	bool create() const {
+		return makeDirectory(Root) && makeDirectory(Leases) && makeDirectory(Done)
+				&& makeDirectory(Failed) && makeDirectory(Results) && makeDirectory(Clocks);
+	}
+
+	string Root, Leases, Done, Failed, Results, Clocks;
+};
+
+// Move a lease aside under a name only this node uses, so it can be inspected without
+// another node changing it. Returns the contents and modification time it had.
+static bool moveLeaseAside(const string& lease, const string& aside, string& outOwner,
+		time_t& outTouched) {
+	if (rename(lease.c_str(), aside.c_str()) != 0) {
+		return false;
+	}
+	struct stat status;
+	outTouched = stat(aside.c_str(), &status) == 0 ? status.st_mtime : 0;
+	outOwner = readFile(aside);
+	return true;
+}
+
+// Put back a lease that was moved aside but turned out to belong to another node. If
+// that node's lease was replaced in the meantime, the newer one is kept.
+static void restoreLease(const string& lease, const string& aside) {
+	if (fileExists(lease)) {
+		remove(aside.c_str());
+	} else {
+		rename(aside.c_str(), lease.c_str());
+	}
+}
+
+// Claim an image, taking over its lease if the node holding it stopped touching it.
+static bool claim(const QueuePaths& paths, const string& image, const string& node) {
+	string lease = paths.Leases + image;
+	if (createExclusive(lease, node)) {
+		return true;
+	}
+
+	struct stat status;
+	if (stat(lease.c_str(), &status) != 0) {
+		return false;
+	}
+	time_t now = sharedNow(paths.Clocks + node);
+	if (now - status.st_mtime < LEASE_SECONDS) {
+		return false;
+	}
+	string staleOwner = readFile(lease);
+
+	// Several nodes may see the lease expire at once. Whichever renames it first moves
+	// the stale lease; a node that renames after another node has already taken it over
+	// gets that node's fresh lease instead, notices, and puts it back.
+	string aside = lease + ".expired." + node;
+	string owner;
+	time_t touched;
+	if (!moveLeaseAside(lease, aside, owner, touched)) {
+		return false;
+	}
+	if (owner != staleOwner || now - touched < LEASE_SECONDS) {
+		restoreLease(lease, aside);
+		return false;
+	}
+	remove(aside.c_str());
+
+	if (!createExclusive(lease, node)) {
+		return false;
+	}
+	cerr << node << ": took over the expired lease of " << image << " from " << staleOwner << endl;
+	return true;
+}
+
+// Remove a lease, but only if this node still holds it. A node that was too slow may
+// have had its lease taken over, and the new holder's lease must stay.
+static void releaseLease(const string& lease, const string& node) {
+	string aside = lease + ".release." + node;
+	string owner;
+	time_t touched;
+	if (!moveLeaseAside(lease, aside, owner, touched)) {
+		return;
+	}
+	if (owner == node) {
+		remove(aside.c_str());
+	} else {
+		restoreLease(lease, aside);
+	}
+}
+
+// Open the node's shard for appending, ending a row cut short by a crash.
+static FILE* openShard(const string& path, const vector<string>& columns) {
+	string existing = readFile(path);
+	FILE* shard = fopen(path.c_str(), "ab");
+	if (shard == nullptr) {
+		cerr << "Error: Could not open " << path << endl;
+		return nullptr;
+	}
+	bool written = true;
+	if (existing.empty()) {
+		string header = formatCsvLine(columns);
+		written = fwrite(header.data(), 1, header.size(), shard) == header.size();
+	} else if (existing.back() != '\n') {
+		written = fputc('\n', shard) != EOF;
+	}
+	if (!written || !syncFile(shard)) {
+		cerr << "Error: Could not write to " << path << endl;
+		fclose(shard);
+		return nullptr;
+	}
+	return shard;
+}
+
+// Rows of a shard by image and form, later rows replacing earlier ones.
+typedef map<pair<string, int>, vector<string>> ShardRows;
+
+static bool loadShard(const string& path, const vector<string>& columns, ShardRows& outRows) {
+	ifstream in(path, ios::binary);
+	vector<string> header, row;
+	if (!parseCsvLine(in, header) || header != columns) {
+		cerr << "Error: " << path << " was written with a different template" << endl;
+		return false;
+	}
+	while (parseCsvRecord(in, columns.size(), row)) {
+		outRows[{ row[0], atoi(row[1].c_str()) }] = row;
+	}
+	return true;
+}
+
+static bool hasImage(const ShardRows& rows, const string& image) {
+	auto first = rows.lower_bound({ image, 0 });
+	return first != rows.end() && first->first.first == image;
+}
+
+// Write every done image's rows from the shard of the node that marked it done.
+static bool mergeShards(const QueuePaths& paths, const vector<string>& images,
+		const vector<string>& columns) {
+	// Every shard, in name order.
+	map<string, ShardRows> shards;
+	vector<cv::String> shardFiles;
+	cv::glob(paths.Results + "*.csv", shardFiles, false);
+	for (auto&& file : shardFiles) {
+		string node = file.substr(paths.Results.size(), file.size() - paths.Results.size() - 4);
+		if (!loadShard(file, columns, shards[node])) {
+			return false;
+		}
+	}
+
+	string merged = formatCsvLine(columns);
+	for (auto&& image : images) {
+		auto shard = shards.find(readFile(paths.Done + image));
+		if (shard == shards.end()) {
+			// The node died while marking the image done, after its rows were written.
+			shard = find_if(shards.begin(), shards.end(),
+					[&](const pair<const string, ShardRows>& rows) { return hasImage(rows.second, image); });
+			if (shard == shards.end()) {
+				continue;
+			}
+		}
+
+		auto& rows = shard->second;
+		for (auto row = rows.lower_bound({ image, 0 }); row != rows.end() && row->first.first == image; ++row) {
+			merged += formatCsvLine(row->second);
+		}
+	}
+
+	fwrite(merged.data(), 1, merged.size(), stdout);
+	fflush(stdout);
+	return true;
+}
+
+int runWorkQueue(const string& directory, string node, const string& svgFile,
+		const ScanSettings& settings, ResultCache* cache) {
+	cv::Size pageSize;
+	auto shapes = findSVGShapes(svgFile, pageSize);
+	if (shapes.count("qr") == 0) {
+		cerr << "Error: Could not find #qr in " << svgFile << endl;
+		return -1;
+	}
+	auto qrBox = shapes["qr"].BoundingBox;
+	if (!settings.layoutShapes) {
+		omitLayoutShapes(shapes);
+	}
+	auto columns = formColumns(shapes);
+
+	if (node.empty()) {
+		node = defaultNodeName();
+	}
+
+	QueuePaths paths(directory);
+	if (!paths.create()) {
+		cerr << "Error: Could not create " << paths.Root << endl;
+		return -1;
+	}
+
+	FILE* shard = openShard(paths.Results + node + ".csv", columns);
+	if (shard == nullptr) {
+		return -1;
+	}
+
+	ScanContext context;
+	context.settings = settings;
+	Heartbeat heartbeat;
+	vector<string> row;
+	vector<unsigned char> bytes;
+	vector<ScanResult> cached;
+	long scanned = 0;
+
+	// Images this node couldn't read: attempts so far and when to try again.
+	map<string, pair<int, chrono::steady_clock::time_point>> unreadable;
+
+	for (;;) {
+		auto images = listImages(directory);
+		vector<string> pending;
+		for (auto&& image : images) {
+			if (!fileExists(paths.Done + image) && !fileExists(paths.Failed + image)) {
+				pending.push_back(image);
+			}
+		}
+		if (pending.empty()) {
+			fclose(shard);
+			cerr << node << ": scanned " << scanned << " of " << images.size() << " images" << endl;
+			for (auto&& image : images) {
+				if (!fileExists(paths.Done + image)) {
+					cerr << "Error: " << image << " could not be read by " << readFile(paths.Failed + image)
+							<< ", remove " << paths.Failed << image << " to try it again" << endl;
+				}
+			}
+			return mergeShards(paths, images, columns) ? 0 : -1;
+		}
+
+		// Start at a different image on each node so they rarely race for the same lease.
+		size_t start = hash<string>()(node) % pending.size();
+		rotate(pending.begin(), pending.begin() + start, pending.end());
+
+		bool claimed = false;
+		for (auto&& image : pending) {
+			auto failure = unreadable.find(image);
+			if (failure != unreadable.end() && chrono::steady_clock::now() < failure->second.second) {
+				continue;
+			}
+			if (!claim(paths, image, node)) {
+				continue;
+			}
+			claimed = true;
+			string lease = paths.Leases + image;
+			if (fileExists(paths.Done + image)) {
+				releaseLease(lease, node); // Finished by another node since we looked.
+				continue;
+			}
+			heartbeat.hold(lease);
+
+			readFileBytes(directory + "/" + image, bytes);
+			auto results = scanEncoded(context, cache, bytes, pageSize, qrBox, shapes, cached);
+			if (results == nullptr) {
+				// Leave the image for a later attempt, by this node or another one.
+				int attempts = failure == unreadable.end() ? 1 : failure->second.first + 1;
+				cerr << "Error: Could not read " << image << " (attempt " << attempts << ")" << endl;
+				if (attempts >= READ_ATTEMPTS) {
+					createExclusive(paths.Failed + image, node);
+				}
+				unreadable[image] = { attempts, chrono::steady_clock::now() + READ_RETRY_INTERVAL };
+				heartbeat.release();
+				releaseLease(lease, node);
+				continue;
+			}
+
+			bool written = true;
+			for (size_t form = 0; form < results->size(); form++) {
+				formatFormRow(image, form, (*results)[form], row);
+				string line = formatCsvLine(row);
+				written = fwrite(line.data(), 1, line.size(), shard) == line.size() && written;
+			}
+
+			// The rows must be safely written before the image is marked done. If they
+			// can't be, e.g. because the share is full or gone, the image is left for
+			// another node and this node stops. A done marker that exists although this
+			// node couldn't create it was made by another node that took the image over.
+			written = written && syncFile(shard);
+			if (!written || (!createExclusive(paths.Done + image, node)
+					&& !fileExists(paths.Done + image))) {
+				cerr << "Error: Could not record the results of " << image << " in "
+						<< paths.Results << ", stopping" << endl;
+				heartbeat.release();
+				releaseLease(lease, node);
+				fclose(shard);
+				return -1;
+			}
+			heartbeat.release();
+			releaseLease(lease, node);
+			scanned++;
+		}
+
+		if (!claimed) {
+			this_thread::sleep_for(IDLE_INTERVAL);
+		}
+	}
+}
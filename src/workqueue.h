@@ -0,0 +1,33 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <map>
+#include <string>
+
+#include "resultcache.h"
+#include "scanner.h"
+#include "sheet.h"
+
+// Scan a directory of images together with other nodes that share it, e.g. laptops on
+// one network share, without a coordinator. State lives in a .queue directory next to
+// the images:
+//   leases/Image    Created exclusively by the node scanning the image. The node
+//                   touches it while it works; a lease older than LEASE_SECONDS is
+//                   taken over by another node, so the images of a node that died are
+//                   scanned again.
+//   results/Node.csv  Rows of the forms each node scanned, in the golden file format.
+//   done/Image      Created once the image's rows are written, naming the node whose
+//                   shard holds them.
+//   failed/Image    Created by a node that couldn't read the image after several
+//                   attempts, naming the node. Remove it to try the image again.
+// A node that can't read an image, e.g. one still being copied, releases it and tries
+// again later. A lease is only removed by the node holding it.
+// A node keeps claiming images until every image is done or failed, then writes all
+// results to stdout, merged in image and form order. Rows come only from the node that
+// marked an image done, so an image scanned twice is counted once and every node prints
+// the same output. The node name defaults to the host name and process id. Images already in the
+// cache, if one is given, aren't scanned again.
+int runWorkQueue(const std::string& directory, std::string node, const std::string& svgFile,
+		const ScanSettings& settings, ResultCache* cache);
+
+#endif